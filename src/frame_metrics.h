@@ -0,0 +1,222 @@
+/*
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * live frame metrics
+ *
+ * the metrics file is a header followed by a fixed size slot per window,
+ * mapped shared so that a collector can map the same file, typically in
+ * /dev/shm, and scrape it at any rate. the writer never waits for readers:
+ * updates are bracketed by a sequence counter that is odd while a window
+ * is being written, and readers copy the slots and retry if the sequence
+ * was odd or changed during the copy. the writer is a single thread.
+ *
+ * each series holds summary statistics over the most recent samples that
+ * the writer keeps, and the sample count over the whole run. times are
+ * microseconds.
+ */
+
+#define FRAME_METRICS_MAGIC 0x54454d46 /* "FMET" */
+
+enum { FRAME_METRICS_VERSION = 1 };
+enum { FRAME_METRICS_MAX_WINDOWS = 16 };
+
+typedef enum {
+    metrics_frame_time,
+    metrics_render_time,
+    metrics_gpu_time,
+    metrics_compositor_latency,
+    metrics_input_latency,
+    metrics_series_count
+} frame_metrics_series_type;
+
+typedef struct
+{
+    uint64_t count;
+    int64_t last;
+    int64_t min;
+    int64_t p50;
+    int64_t p95;
+    int64_t p99;
+    int64_t max;
+    int64_t mean;
+} frame_metrics_series;
+
+typedef struct
+{
+    uint64_t frames;
+    uint64_t sync_serial;
+    int64_t update_time;
+    int32_t width;
+    int32_t height;
+    frame_metrics_series series[metrics_series_count];
+} frame_metrics_window;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t window_size;
+    uint32_t num_windows;
+    int64_t start_time;
+    _Atomic uint64_t sequence;
+    uint64_t reserved[4];
+} frame_metrics_header;
+
+typedef struct
+{
+    int fd;
+    size_t length;
+    frame_metrics_header *header;
+    frame_metrics_window *windows;
+} frame_metrics;
+
+static const char* frame_metrics_series_names[] = {
+    [metrics_frame_time] = "frame_time",
+    [metrics_render_time] = "render_time",
+    [metrics_gpu_time] = "gpu_time",
+    [metrics_compositor_latency] = "compositor_latency",
+    [metrics_input_latency] = "input_latency",
+};
+
+static int frame_metrics_create(frame_metrics *fm, const char *filename,
+    uint32_t num_windows, int64_t start_time);
+static int frame_metrics_open(frame_metrics *fm, const char *filename);
+static void frame_metrics_close(frame_metrics *fm);
+static frame_metrics_window* frame_metrics_begin(frame_metrics *fm,
+    uint32_t window);
+static void frame_metrics_end(frame_metrics *fm);
+static int frame_metrics_snapshot(frame_metrics *fm,
+    frame_metrics_window *windows);
+
+static int frame_metrics_map(frame_metrics *fm, int prot)
+{
+    void *addr = mmap(NULL, fm->length, prot, MAP_SHARED, fm->fd, 0);
+    if (addr == MAP_FAILED) {
+        close(fm->fd);
+        return -1;
+    }
+    fm->header = (frame_metrics_header*)addr;
+    fm->windows = (frame_metrics_window*)(fm->header + 1);
+    return 0;
+}
+
+static int frame_metrics_create(frame_metrics *fm, const char *filename,
+    uint32_t num_windows, int64_t start_time)
+{
+    if (num_windows > FRAME_METRICS_MAX_WINDOWS) {
+        num_windows = FRAME_METRICS_MAX_WINDOWS;
+    }
+    fm->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fm->fd < 0) return -1;
+    fm->length = sizeof(frame_metrics_header) +
+        (size_t)num_windows * sizeof(frame_metrics_window);
+    if (ftruncate(fm->fd, fm->length) < 0) {
+        close(fm->fd);
+        return -1;
+    }
+    if (frame_metrics_map(fm, PROT_READ | PROT_WRITE) < 0) return -1;
+    fm->header->magic = FRAME_METRICS_MAGIC;
+    fm->header->version = FRAME_METRICS_VERSION;
+    fm->header->window_size = sizeof(frame_metrics_window);
+    fm->header->num_windows = num_windows;
+    fm->header->start_time = start_time;
+    atomic_init(&fm->header->sequence, 0);
+    return 0;
+}
+
+static int frame_metrics_open(frame_metrics *fm, const char *filename)
+{
+    struct stat statbuf;
+
+    fm->fd = open(filename, O_RDONLY);
+    if (fm->fd < 0) return -1;
+    if (fstat(fm->fd, &statbuf) < 0 ||
+        statbuf.st_size < (off_t)sizeof(frame_metrics_header)) {
+        close(fm->fd);
+        return -1;
+    }
+    fm->length = statbuf.st_size;
+    if (frame_metrics_map(fm, PROT_READ) < 0) return -1;
+    if (fm->header->magic != FRAME_METRICS_MAGIC ||
+        fm->header->version != FRAME_METRICS_VERSION ||
+        fm->header->window_size != sizeof(frame_metrics_window) ||
+        fm->header->num_windows > FRAME_METRICS_MAX_WINDOWS ||
+        fm->length < sizeof(frame_metrics_header) +
+            (size_t)fm->header->num_windows * sizeof(frame_metrics_window)) {
+        frame_metrics_close(fm);
+        return -1;
+    }
+    return 0;
+}
+
+static void frame_metrics_close(frame_metrics *fm)
+{
+    if (!fm->header) return;
+    munmap(fm->header, fm->length);
+    close(fm->fd);
+    fm->header = NULL;
+    fm->windows = NULL;
+}
+
+/*
+ * returns the slot of a window to update, or NULL if the window has no
+ * slot. every call that returns a slot must be paired with a call to
+ * frame_metrics_end.
+ */
+static frame_metrics_window* frame_metrics_begin(frame_metrics *fm,
+    uint32_t window)
+{
+    if (window >= fm->header->num_windows) return NULL;
+    atomic_fetch_add_explicit(&fm->header->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    return &fm->windows[window];
+}
+
+static void frame_metrics_end(frame_metrics *fm)
+{
+    atomic_fetch_add_explicit(&fm->header->sequence, 1, memory_order_release);
+}
+
+/*
+ * copy every window slot, returns the number of windows copied
+ */
+static int frame_metrics_snapshot(frame_metrics *fm,
+    frame_metrics_window *windows)
+{
+    uint32_t n = fm->header->num_windows;
+    uint64_t begin, end;
+
+    do {
+        begin = atomic_load_explicit(&fm->header->sequence,
+            memory_order_acquire);
+        memcpy(windows, fm->windows, n * sizeof(frame_metrics_window));
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(&fm->header->sequence,
+            memory_order_relaxed);
+    } while ((begin & 1) != 0 || begin != end);
+
+    return (int)n;
+}
@@ -0,0 +1,231 @@
+/*
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * binary frame trace
+ *
+ * the trace file is a header followed by a ring of fixed size records that
+ * is mapped shared into the process. recording a record is an atomic add to
+ * the head index and a store into the mapping, the kernel writes the pages
+ * back asynchronously and the file remains valid if the process is killed.
+ * when the ring wraps the oldest records are overwritten, so readers use
+ * records from max(head - capacity, 0) to head.
+ *
+ * sync serials are per window, so every record carries the index of its
+ * window, or FRAME_TRACE_NO_WINDOW for polls and events without a window.
+ *
+ * record arguments by type:
+ *
+ * - trace_poll           arg[0] = timeout
+ * - trace_event          flags = X event type, arg[0] = X serial
+ * - trace_delay          arg[0] = timing_sync_serial,
+ *                        arg[1] = inflight_sync_serial,
+ *                        arg[2] = inflight_count
+ * - trace_frame_begin    flags = disposition, arg[0] = sync_serial,
+ *                        arg[1] = delta_time
+ * - trace_frame_end      arg[0] = sync_serial, arg[1] = render_time
+ * - trace_sync_request   arg[0] = sync_serial, arg[1] = extended_sync
+ * - trace_configure      arg[0] = width, arg[1] = height,
+ *                        arg[2] = sync_serial
+ * - trace_frame_drawn    arg[0] = sync_serial, arg[1] = drawn_time
+ * - trace_frame_timings  arg[0] = sync_serial,
+ *                        arg[1] = presentation_offset,
+ *                        arg[2] = refresh_interval | frame_delay << 32
+ * - trace_present_complete  flags = kind, arg[0] = ust, arg[1] = msc,
+ *                        arg[2] = mode
+ */
+
+#define FRAME_TRACE_MAGIC 0x43525446 /* "FTRC" */
+
+enum { FRAME_TRACE_VERSION = 1 };
+enum { FRAME_TRACE_DEFAULT_CAPACITY = 1 << 18 };
+
+#define FRAME_TRACE_NO_WINDOW 0xffffffffu
+
+typedef enum {
+    trace_poll,
+    trace_event,
+    trace_delay,
+    trace_frame_begin,
+    trace_frame_end,
+    trace_sync_request,
+    trace_configure,
+    trace_frame_drawn,
+    trace_frame_timings,
+    trace_present_complete,
+    trace_type_count
+} frame_trace_type;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;
+    int64_t start_time;
+    _Atomic uint64_t head;
+    uint64_t reserved[4];
+} frame_trace_header;
+
+typedef struct
+{
+    int64_t time;
+    uint64_t frame_number;
+    uint16_t type;
+    uint16_t flags;
+    uint32_t window;
+    uint64_t arg[3];
+} frame_trace_record;
+
+typedef struct
+{
+    int fd;
+    size_t length;
+    frame_trace_header *header;
+    frame_trace_record *records;
+} frame_trace;
+
+static const char* frame_trace_type_names[] = {
+    [trace_poll] = "poll",
+    [trace_event] = "event",
+    [trace_delay] = "delay",
+    [trace_frame_begin] = "frame_begin",
+    [trace_frame_end] = "frame_end",
+    [trace_sync_request] = "sync_request",
+    [trace_configure] = "configure",
+    [trace_frame_drawn] = "frame_drawn",
+    [trace_frame_timings] = "frame_timings",
+    [trace_present_complete] = "present_complete",
+};
+
+static int frame_trace_create(frame_trace *ft, const char *filename,
+    uint32_t capacity, int64_t start_time);
+static int frame_trace_open(frame_trace *ft, const char *filename);
+static void frame_trace_close(frame_trace *ft);
+static void frame_trace_add(frame_trace *ft, int64_t time,
+    uint64_t frame_number, uint32_t window, frame_trace_type type,
+    uint16_t flags, uint64_t arg0, uint64_t arg1, uint64_t arg2);
+static uint64_t frame_trace_first(frame_trace *ft);
+static uint64_t frame_trace_last(frame_trace *ft);
+static frame_trace_record* frame_trace_get(frame_trace *ft, uint64_t idx);
+
+static int frame_trace_map(frame_trace *ft, int prot)
+{
+    void *addr = mmap(NULL, ft->length, prot, MAP_SHARED, ft->fd, 0);
+    if (addr == MAP_FAILED) {
+        close(ft->fd);
+        return -1;
+    }
+    ft->header = (frame_trace_header*)addr;
+    ft->records = (frame_trace_record*)(ft->header + 1);
+    return 0;
+}
+
+static int frame_trace_create(frame_trace *ft, const char *filename,
+    uint32_t capacity, int64_t start_time)
+{
+    ft->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (ft->fd < 0) return -1;
+    ft->length = sizeof(frame_trace_header) +
+        (size_t)capacity * sizeof(frame_trace_record);
+    if (ftruncate(ft->fd, ft->length) < 0) {
+        close(ft->fd);
+        return -1;
+    }
+    if (frame_trace_map(ft, PROT_READ | PROT_WRITE) < 0) return -1;
+    ft->header->magic = FRAME_TRACE_MAGIC;
+    ft->header->version = FRAME_TRACE_VERSION;
+    ft->header->record_size = sizeof(frame_trace_record);
+    ft->header->capacity = capacity;
+    ft->header->start_time = start_time;
+    atomic_init(&ft->header->head, 0);
+    return 0;
+}
+
+static int frame_trace_open(frame_trace *ft, const char *filename)
+{
+    struct stat statbuf;
+
+    ft->fd = open(filename, O_RDONLY);
+    if (ft->fd < 0) return -1;
+    if (fstat(ft->fd, &statbuf) < 0 ||
+        statbuf.st_size < (off_t)sizeof(frame_trace_header)) {
+        close(ft->fd);
+        return -1;
+    }
+    ft->length = statbuf.st_size;
+    if (frame_trace_map(ft, PROT_READ) < 0) return -1;
+    if (ft->header->magic != FRAME_TRACE_MAGIC ||
+        ft->header->version != FRAME_TRACE_VERSION ||
+        ft->header->record_size != sizeof(frame_trace_record) ||
+        ft->header->capacity == 0 ||
+        ft->length < sizeof(frame_trace_header) +
+            (size_t)ft->header->capacity * sizeof(frame_trace_record)) {
+        frame_trace_close(ft);
+        return -1;
+    }
+    return 0;
+}
+
+static void frame_trace_close(frame_trace *ft)
+{
+    if (!ft->header) return;
+    munmap(ft->header, ft->length);
+    close(ft->fd);
+    ft->header = NULL;
+    ft->records = NULL;
+}
+
+static void frame_trace_add(frame_trace *ft, int64_t time,
+    uint64_t frame_number, uint32_t window, frame_trace_type type,
+    uint16_t flags, uint64_t arg0, uint64_t arg1, uint64_t arg2)
+{
+    uint64_t idx = atomic_fetch_add_explicit(&ft->header->head, 1,
+        memory_order_relaxed);
+    frame_trace_record *r = &ft->records[idx % ft->header->capacity];
+    r->time = time;
+    r->frame_number = frame_number;
+    r->type = type;
+    r->flags = flags;
+    r->window = window;
+    r->arg[0] = arg0;
+    r->arg[1] = arg1;
+    r->arg[2] = arg2;
+}
+
+static uint64_t frame_trace_first(frame_trace *ft)
+{
+    uint64_t head = atomic_load(&ft->header->head);
+    return head > ft->header->capacity ? head - ft->header->capacity : 0;
+}
+
+static uint64_t frame_trace_last(frame_trace *ft)
+{
+    return atomic_load(&ft->header->head);
+}
+
+static frame_trace_record* frame_trace_get(frame_trace *ft, uint64_t idx)
+{
+    return &ft->records[idx % ft->header->capacity];
+}
@@ -0,0 +1,485 @@
+/*
+ * gl2_bench
+ *
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * micro-benchmarks
+ *
+ * gl2_xsync.c is included so that its static scheduling code can be
+ * driven directly. no display or GL context is opened: frame pacing runs
+ * against the --bench compositor script on a simulated clock, with the
+ * XSync extension absent and a single frame in flight, so no GL or X
+ * calls are made. XFlush is replaced with a no-op because the gate
+ * flushes deferred frames.
+ *
+ * results are written one JSON object per line.
+ */
+
+#include <X11/Xlib.h>
+
+#define XFlush(d) ((void)(d), 0)
+#define main gl2_xsync_main
+#include "gl2_xsync.c"
+#undef main
+#undef XFlush
+
+typedef struct
+{
+    const char *name;
+    void (*fn)(ulong iterations);
+} bench_def;
+
+static volatile float bench_sink;
+
+static long bench_min_time = 200000;
+
+static long bench_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static float bench_rand()
+{
+    return (float)rand() / (float)RAND_MAX * 2.0f - 1.0f;
+}
+
+static void bench_random_mat4x4(mat4x4 m)
+{
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            m[i][j] = bench_rand();
+        }
+    }
+}
+
+/*
+ * sum every element so that no part of a result can be optimized away
+ */
+static float bench_mat4x4_sum(mat4x4 m)
+{
+    float s = 0.0f;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            s += m[i][j];
+        }
+    }
+    return s;
+}
+
+/*
+ * linmath kernels
+ */
+
+static void bench_mat4x4_mul(ulong iterations)
+{
+    mat4x4 a, b;
+    vec3 scale = { 1.0f, 1.0f, 1.0f }, trans = { 0.0f, 0.0f, 0.0f };
+    vec3 rot = { 0.25f, 0.5f, 0.75f };
+    /* a rotation keeps the accumulated product bounded */
+    bench_random_mat4x4(a);
+    mat4x4_compose_trs(b, scale, trans, rot);
+    for (ulong i = 0; i < iterations; i++) {
+        mat4x4_mul(a, a, b);
+    }
+    bench_sink = a[3][3];
+}
+
+static void bench_mat4x4_rotate(ulong iterations)
+{
+    mat4x4 m;
+    mat4x4_identity(m);
+    for (ulong i = 0; i < iterations; i++) {
+        mat4x4_rotate_X(m, m, 0.25f);
+        mat4x4_rotate_Y(m, m, 0.5f);
+        mat4x4_rotate_Z(m, m, 0.75f);
+    }
+    bench_sink = m[0][0];
+}
+
+static void bench_mat4x4_trs_chain(ulong iterations)
+{
+    mat4x4 m;
+    float s = 0.0f;
+    for (ulong i = 0; i < iterations; i++) {
+        float a = (float)i * 1e-3f;
+        mat4x4_identity(m);
+        mat4x4_scale_aniso(m, m, 1.0f, 2.0f, 3.0f);
+        mat4x4_translate_in_place(m, 4.0f, 5.0f, 6.0f);
+        mat4x4_rotate_X(m, m, a);
+        mat4x4_rotate_Y(m, m, a * 2.0f);
+        mat4x4_rotate_Z(m, m, a * 3.0f);
+        s += bench_mat4x4_sum(m);
+    }
+    bench_sink = s;
+}
+
+static void bench_mat4x4_compose_trs(ulong iterations)
+{
+    mat4x4 m;
+    vec3 scale = { 1.0f, 2.0f, 3.0f }, trans = { 4.0f, 5.0f, 6.0f };
+    float s = 0.0f;
+    for (ulong i = 0; i < iterations; i++) {
+        float a = (float)i * 1e-3f;
+        vec3 rot = { a, a * 2.0f, a * 3.0f };
+        mat4x4_compose_trs(m, scale, trans, rot);
+        s += bench_mat4x4_sum(m);
+    }
+    bench_sink = s;
+}
+
+enum { BENCH_SOA_COUNT = 1024 };
+
+static void bench_mat4x4_mul_n(ulong iterations)
+{
+    static float a[16 * BENCH_SOA_COUNT], b[16 * BENCH_SOA_COUNT];
+    static float r[16 * BENCH_SOA_COUNT];
+    for (size_t i = 0; i < 16 * BENCH_SOA_COUNT; i++) {
+        a[i] = bench_rand();
+        b[i] = bench_rand();
+    }
+    /* one iteration is one matrix multiply */
+    for (ulong i = 0; i < iterations; i += BENCH_SOA_COUNT) {
+        ulong n = iterations - i < BENCH_SOA_COUNT ? iterations - i :
+            BENCH_SOA_COUNT;
+        mat4x4_mul_n(r, a, b, n);
+    }
+    bench_sink = r[0];
+}
+
+static void bench_model_update_instances(ulong iterations)
+{
+    model_object_t m = { 0 };
+    m.instance_count = BENCH_SOA_COUNT;
+    instance *inst = (instance*)malloc(sizeof(instance) * BENCH_SOA_COUNT);
+    /* one iteration is one instance transform */
+    for (ulong i = 0; i < iterations; i += BENCH_SOA_COUNT) {
+        ulong n = iterations - i < BENCH_SOA_COUNT ? iterations - i :
+            BENCH_SOA_COUNT;
+        model_update_instances(&m, inst, (float)i, 0, (uint)n);
+    }
+    bench_sink = inst[0].m[3][0];
+    free(inst);
+}
+
+/*
+ * vertex and index buffers
+ */
+
+static void bench_vertex_buffer_add(ulong iterations)
+{
+    vertex_buffer vb;
+    vertex v = { { 1.f, 2.f, 3.f }, { 0.f, 0.f, 1.f }, { 0.f, 1.f },
+                 { 1.f, 1.f, 1.f, 1.f } };
+    vertex_buffer_init(&vb);
+    for (ulong i = 0; i < iterations; i++) {
+        v.pos.x = (float)i;
+        vertex_buffer_add(&vb, v);
+    }
+    bench_sink = (float)vertex_buffer_count(&vb);
+    vertex_buffer_destroy(&vb);
+}
+
+static void bench_index_buffer_add_primitves(ulong iterations)
+{
+    index_buffer ib;
+    index_buffer_init(&ib);
+    /* one iteration is one quad */
+    for (ulong i = 0; i < iterations; i += 64) {
+        ulong n = iterations - i < 64 ? iterations - i : 64;
+        index_buffer_add_primitves(&ib, primitive_topology_quads, n,
+            (uint)(i * 4));
+    }
+    bench_sink = (float)index_buffer_count(&ib);
+    index_buffer_destroy(&ib);
+}
+
+/*
+ * attribute lookup by name, as done when resolving program locations
+ */
+
+static const char *bench_attr_names[] = {
+    "a_pos", "a_normal", "a_uv", "a_color", "a_model", "a_instance_color",
+    "u_model", "u_view", "u_projection", "u_lightpos", "u_time",
+    "u_resolution", "u_noise", "u_shadow", "u_fog_color", "u_fog_density",
+};
+
+static void bench_attr_list_value(ulong iterations)
+{
+    attr_list list = { 0 };
+    size_t n = array_size(bench_attr_names);
+    GLuint sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        attr_list_set(&list, bench_attr_names[i], (GLuint)i);
+    }
+    for (ulong i = 0; i < iterations; i++) {
+        sum += attr_list_value(&list, bench_attr_names[i % n]);
+    }
+    bench_sink = (float)sum;
+    for (size_t i = 0; i < list.count; i++) {
+        free((void*)list.arr[i].name);
+    }
+    free(list.arr);
+}
+
+/*
+ * timing series
+ */
+
+static void bench_timing_series_add(ulong iterations)
+{
+    timing_series ts;
+    timing_series_init(&ts);
+    for (ulong i = 0; i < iterations; i++) {
+        timing_series_add(&ts, 16000 + (long)(rand() % 2000));
+    }
+    bench_sink = (float)timing_series_median(&ts);
+}
+
+static void bench_timing_series_percentile(ulong iterations)
+{
+    timing_series ts;
+    long sum = 0;
+    timing_series_init(&ts);
+    for (int i = 0; i < TIMING_SERIES_SIZE; i++) {
+        timing_series_add(&ts, 16000 + (long)(rand() % 2000));
+    }
+    for (ulong i = 0; i < iterations; i++) {
+        sum += timing_series_percentile(&ts, (int)(i % 100));
+    }
+    bench_sink = (float)sum;
+}
+
+/*
+ * frame pacing against the scripted compositor
+ *
+ * the --bench compositor script runs on a simulated clock, and its events
+ * are decoded by process_xevent and coalesced as they would be from the
+ * Xlib queue. there is no server to intern atoms, so they are given
+ * distinct placeholder values, and configure storms are left off because
+ * the expose that ends a storm draws a frame with GL. each iteration
+ * delivers the script events that are due, then submits a frame with the
+ * same gate, schedule and serial logic as submit_frame, or advances the
+ * clock to the next frame or script event.
+ */
+
+enum { PACING_RENDER_TIME = 3000 };
+
+static ulong pacing_frames, pacing_delays;
+static long pacing_last_frame_time;
+static timing_series pacing_interval_buffer;
+static app_window *pacing_window = &windows[0];
+
+static void pacing_reset(schedule_mode mode, ulong iterations)
+{
+    scheduler = mode;
+    memset(pacing_window, 0, sizeof(app_window));
+    pacing_window->render_scale = 1.0f;
+    frame_number = 0;
+    timing_series_init(&pacing_window->frame_time_buffer);
+    timing_series_init(&pacing_window->render_time_buffer);
+    timing_series_init(&pacing_window->compositor_latency_buffer);
+    timing_series_init(&pacing_window->gpu_time_buffer);
+    timing_series_init(&pacing_window->input_latency_buffer);
+    timing_series_init(&pacing_interval_buffer);
+    for (size_t i = 0; i < array_size(atom_table); i++) {
+        *atom_table[i].atom = (Atom)(i + 1);
+    }
+    memset(script_windows, 0, sizeof(script_windows));
+    script_sync_requests = script_dropped = script_late = 0;
+    script_violations = script_frame_count = 0;
+    script_storm_interval = 0;
+    bench_frames = iterations;
+    pacing_frames = pacing_delays = 0;
+    pacing_last_frame_time = 0;
+    current_time = pacing_window->next_draw_time = SCRIPT_REFRESH_INTERVAL;
+}
+
+/*
+ * deliver script events due at now, returns the time of the next event
+ */
+static long pacing_compositor(long now)
+{
+    long next = script_collect(NULL, now);
+
+    for (uint i = 0; i < script_event_count; i++) {
+        process_xevent(NULL, &script_events[i], now);
+    }
+    script_event_count = 0;
+    coalesce_flush(NULL, pacing_window);
+    return next;
+}
+
+static void pacing_submit(float target_frame_rate)
+{
+    app_window *win = pacing_window;
+
+    if (submit_frame_delayed(NULL, win, frame_normal)) {
+        pacing_delays++;
+        return;
+    }
+
+    if (win->last_draw_time) {
+        win->delta_time = current_time - win->last_draw_time;
+        timing_series_add(&win->frame_time_buffer, win->delta_time);
+    }
+    win->last_draw_time = current_time;
+    schedule_frame(win, target_frame_rate);
+    frame_number++;
+
+    begin_frame(NULL, win, frame_normal);
+    end_frame(NULL, win);
+    inflight_push(win, win->current_sync_serial, win->last_draw_time, 0);
+
+    /* the script composites the frame from the time it ends */
+    current_time += PACING_RENDER_TIME;
+    win->render_time = PACING_RENDER_TIME;
+    timing_series_add(&win->render_time_buffer, win->render_time);
+    script_frame_submitted(NULL, win);
+
+    if (pacing_last_frame_time) {
+        timing_series_add(&pacing_interval_buffer,
+            win->last_draw_time - pacing_last_frame_time);
+    }
+    pacing_last_frame_time = win->last_draw_time;
+    pacing_frames++;
+}
+
+static void pacing_run(schedule_mode mode, ulong iterations)
+{
+    pacing_reset(mode, iterations);
+    for (ulong i = 0; i < iterations; i++) {
+        long event_time = pacing_compositor(current_time);
+        if (current_time >= pacing_window->next_draw_time) {
+            pacing_submit(frame_rate);
+            continue;
+        }
+        current_time = pacing_window->next_draw_time;
+        if (event_time && event_time < current_time) {
+            current_time = event_time;
+        }
+    }
+}
+
+static void bench_pacing_clock(ulong iterations)
+{
+    pacing_run(schedule_clock, iterations);
+}
+
+static void bench_pacing_vblank(ulong iterations)
+{
+    pacing_run(schedule_vblank, iterations);
+}
+
+static bench_def benchmarks[] = {
+    { "mat4x4_mul", bench_mat4x4_mul },
+    { "mat4x4_rotate_xyz", bench_mat4x4_rotate },
+    { "mat4x4_trs_chain", bench_mat4x4_trs_chain },
+    { "mat4x4_compose_trs", bench_mat4x4_compose_trs },
+    { "mat4x4_mul_n", bench_mat4x4_mul_n },
+    { "model_update_instances", bench_model_update_instances },
+    { "vertex_buffer_add", bench_vertex_buffer_add },
+    { "index_buffer_add_primitves", bench_index_buffer_add_primitves },
+    { "attr_list_value", bench_attr_list_value },
+    { "timing_series_add", bench_timing_series_add },
+    { "timing_series_percentile", bench_timing_series_percentile },
+    { "pacing_clock", bench_pacing_clock },
+    { "pacing_vblank", bench_pacing_vblank },
+};
+
+/*
+ * double the iteration count until a run takes at least bench_min_time
+ */
+static void bench_run(bench_def *b)
+{
+    ulong iterations = 1;
+    long elapsed;
+
+    for (;;) {
+        srand(1);
+        long start = bench_time_ns();
+        b->fn(iterations);
+        elapsed = bench_time_ns() - start;
+        if (elapsed >= bench_min_time * 1000 || iterations >= (1ul << 40)) {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    double ns_per_op = (double)elapsed / (double)iterations;
+    printf("{\"name\":\"%s\",\"iterations\":%lu,\"time_ns\":%ld,"
+        "\"ns_per_op\":%.3f,\"ops_per_sec\":%.0f",
+        b->name, iterations, elapsed, ns_per_op, 1e9 / ns_per_op);
+    if (b->fn == bench_pacing_clock || b->fn == bench_pacing_vblank) {
+        printf(",\"pacing_frames\":%lu,\"pacing_delays\":%lu,"
+            "\"pacing_interval_p50_us\":%ld,\"pacing_interval_p95_us\":%ld,"
+            "\"pacing_interval_max_us\":%ld,\"dropped\":%lu,\"late\":%lu,"
+            "\"violations\":%lu",
+            pacing_frames, pacing_delays,
+            timing_series_median(&pacing_interval_buffer),
+            timing_series_percentile(&pacing_interval_buffer, 95),
+            timing_series_max(&pacing_interval_buffer),
+            script_dropped, script_late, script_violations);
+    }
+    printf("}\n");
+    fflush(stdout);
+}
+
+static int print_bench_usage_and_exit(const char *argv0)
+{
+    fprintf(stderr, "\nusage: %s [options]\n\n"
+                    "-h, --help              print this help message\n"
+                    "-l, --list              list benchmark names\n"
+                    "-f, --filter <substr>   run benchmarks matching substring\n"
+                    "-m, --min-time <ms>     minimum time per benchmark (default %ld)\n\n",
+        argv0, bench_min_time / 1000);
+    exit(9);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = NULL;
+    int help = 0, list = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (match_option(argv[i], "-h", "--help")) {
+            help = 1;
+        } else if (match_option(argv[i], "-l", "--list")) {
+            list = 1;
+        } else if (match_option(argv[i], "-f", "--filter") && i+1 < argc) {
+            filter = argv[++i];
+        } else if (match_option(argv[i], "-m", "--min-time") && i+1 < argc) {
+            bench_min_time = atol(argv[++i]) * 1000;
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            help = 1;
+        }
+    }
+
+    if (help) print_bench_usage_and_exit(argv[0]);
+
+    for (size_t i = 0; i < array_size(benchmarks); i++) {
+        if (filter && !strstr(benchmarks[i].name, filter)) continue;
+        if (list) {
+            printf("%s\n", benchmarks[i].name);
+        } else {
+            bench_run(&benchmarks[i]);
+        }
+    }
+
+    return 0;
+}
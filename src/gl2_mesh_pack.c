@@ -0,0 +1,484 @@
+/*
+ * gl2_mesh_pack
+ *
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "mesh_file.h"
+#include "mesh_optimize.h"
+
+#define Panic(...) { fprintf(stderr, __VA_ARGS__); exit(9); }
+
+/*
+ * Wavefront OBJ to binary mesh converter
+ *
+ * reads positions with optional per-vertex colours, texture coordinates,
+ * normals and polygonal faces, which are triangulated as fans. corners
+ * with the same position, texture coordinate and normal index share one
+ * vertex. when a corner has no normal, normals are accumulated from the
+ * faces using the vertex. the output uses the quantized layout unless
+ * --float is given. --optimize welds and reorders the mesh for the vertex
+ * cache and vertex fetch, and --overdraw also reorders it for overdraw.
+ */
+
+typedef struct { float v[4]; } vec4;
+typedef struct { int p, t, n; } corner;
+
+typedef struct {
+    void *arr;
+    size_t count;
+    size_t capacity;
+    size_t stride;
+} array;
+
+typedef struct {
+    float pos[3];
+    float norm[3];
+    float uv[2];
+    float col[4];
+} mesh_vertex;
+
+static array positions, colors, uvs, normals;
+static array vertices, indices;
+static corner *vertex_keys;
+static uint32_t *vertex_map;
+static size_t vertex_map_size;
+
+static bool use_float;
+static bool optimize_mesh;
+static bool optimize_overdraw;
+static const char *input_filename;
+static const char *output_filename;
+
+static void array_init(array *a, size_t stride)
+{
+    a->arr = NULL;
+    a->count = a->capacity = 0;
+    a->stride = stride;
+}
+
+static void* array_add(array *a)
+{
+    if (a->count == a->capacity) {
+        a->capacity = a->capacity ? a->capacity << 1 : 256;
+        a->arr = realloc(a->arr, a->capacity * a->stride);
+        if (!a->arr) Panic("out of memory\n");
+    }
+    return (char*)a->arr + a->stride * a->count++;
+}
+
+static void* array_get(array *a, size_t i)
+{
+    return (char*)a->arr + a->stride * i;
+}
+
+/*
+ * open addressing map from corner indices to vertex index
+ */
+
+static uint32_t corner_hash(corner c)
+{
+    uint32_t h = 2166136261u;
+    h = (h ^ (uint32_t)c.p) * 16777619u;
+    h = (h ^ (uint32_t)c.t) * 16777619u;
+    h = (h ^ (uint32_t)c.n) * 16777619u;
+    return h;
+}
+
+static void vertex_map_grow()
+{
+    size_t old_size = vertex_map_size;
+    uint32_t *old_map = vertex_map;
+
+    vertex_map_size = old_size ? old_size << 1 : 1024;
+    vertex_map = malloc(vertex_map_size * sizeof(uint32_t));
+    if (!vertex_map) Panic("out of memory\n");
+    memset(vertex_map, 0xff, vertex_map_size * sizeof(uint32_t));
+
+    for (size_t i = 0; i < old_size; i++) {
+        if (old_map[i] == UINT32_MAX) continue;
+        size_t j = corner_hash(vertex_keys[old_map[i]]) & (vertex_map_size - 1);
+        while (vertex_map[j] != UINT32_MAX) j = (j + 1) & (vertex_map_size - 1);
+        vertex_map[j] = old_map[i];
+    }
+    free(old_map);
+}
+
+static vec4 attr_value(array *a, int i, vec4 def)
+{
+    return i >= 0 ? *(vec4*)array_get(a, i) : def;
+}
+
+static uint32_t vertex_find_or_add(corner c)
+{
+    if ((vertices.count + 1) * 2 > vertex_map_size) vertex_map_grow();
+
+    size_t j = corner_hash(c) & (vertex_map_size - 1);
+    while (vertex_map[j] != UINT32_MAX) {
+        corner k = vertex_keys[vertex_map[j]];
+        if (k.p == c.p && k.t == c.t && k.n == c.n) return vertex_map[j];
+        j = (j + 1) & (vertex_map_size - 1);
+    }
+
+    uint32_t idx = (uint32_t)vertices.count;
+    mesh_vertex *v = array_add(&vertices);
+    vertex_keys = realloc(vertex_keys, vertices.capacity * sizeof(corner));
+    if (!vertex_keys) Panic("out of memory\n");
+    vertex_keys[idx] = c;
+    vertex_map[j] = idx;
+
+    vec4 p = attr_value(&positions, c.p, (vec4){{0, 0, 0, 1}});
+    vec4 t = attr_value(&uvs, c.t, (vec4){{0, 0, 0, 0}});
+    vec4 n = attr_value(&normals, c.n, (vec4){{0, 0, 0, 0}});
+    vec4 col = attr_value(&colors, c.p, (vec4){{1, 1, 1, 1}});
+    memcpy(v->pos, p.v, sizeof(v->pos));
+    memcpy(v->norm, n.v, sizeof(v->norm));
+    memcpy(v->uv, t.v, sizeof(v->uv));
+    memcpy(v->col, col.v, sizeof(v->col));
+
+    return idx;
+}
+
+/*
+ * resolve a 1-based or negative relative OBJ index to 0-based or -1
+ */
+static int obj_index(const char *s, size_t count, int lineno)
+{
+    if (!s || !*s) return -1;
+    long i = strtol(s, NULL, 10);
+    if (i < 0) i += (long)count; else i -= 1;
+    if (i < 0 || i >= (long)count) {
+        Panic("%s:%d: index out of range: %s\n", input_filename, lineno, s);
+    }
+    return (int)i;
+}
+
+static corner parse_corner(char *tok, int lineno)
+{
+    char *p = tok, *t = NULL, *n = NULL, *slash;
+
+    if ((slash = strchr(p, '/'))) {
+        *slash = 0;
+        t = slash + 1;
+        if ((slash = strchr(t, '/'))) {
+            *slash = 0;
+            n = slash + 1;
+        }
+    }
+    return (corner){
+        obj_index(p, positions.count, lineno),
+        obj_index(t, uvs.count, lineno),
+        obj_index(n, normals.count, lineno)
+    };
+}
+
+static void face_normal(uint32_t a, uint32_t b, uint32_t c)
+{
+    mesh_vertex *va = array_get(&vertices, a);
+    mesh_vertex *vb = array_get(&vertices, b);
+    mesh_vertex *vc = array_get(&vertices, c);
+    float e1[3], e2[3], n[3];
+
+    for (int i = 0; i < 3; i++) {
+        e1[i] = vb->pos[i] - va->pos[i];
+        e2[i] = vc->pos[i] - va->pos[i];
+    }
+    n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+    n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+    n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+    uint32_t tri[3] = { a, b, c };
+    for (int j = 0; j < 3; j++) {
+        if (vertex_keys[tri[j]].n >= 0) continue;
+        mesh_vertex *v = array_get(&vertices, tri[j]);
+        for (int i = 0; i < 3; i++) v->norm[i] += n[i];
+    }
+}
+
+static void parse_face(char *rest, int lineno)
+{
+    uint32_t first = 0, prev = 0;
+    int n = 0;
+
+    for (char *tok = strtok(rest, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        uint32_t idx = vertex_find_or_add(parse_corner(tok, lineno));
+        if (n == 0) {
+            first = idx;
+        } else if (n >= 2) {
+            *(uint32_t*)array_add(&indices) = first;
+            *(uint32_t*)array_add(&indices) = prev;
+            *(uint32_t*)array_add(&indices) = idx;
+            face_normal(first, prev, idx);
+        }
+        prev = idx;
+        n++;
+    }
+    if (n < 3) Panic("%s:%d: face with %d vertices\n", input_filename, lineno, n);
+}
+
+static void parse_obj(const char *filename)
+{
+    char line[4096];
+    int lineno = 0;
+    FILE *f;
+
+    if ((f = fopen(filename, "r")) == NULL) {
+        Panic("cannot open: %s: %s\n", filename, strerror(errno));
+    }
+    while (fgets(line, sizeof(line), f)) {
+        vec4 a = {{0, 0, 0, 1}};
+        lineno++;
+        if (strncmp(line, "v ", 2) == 0) {
+            vec4 c = {{1, 1, 1, 1}};
+            int n = sscanf(line + 2, "%f %f %f %f %f %f", &a.v[0], &a.v[1],
+                &a.v[2], &c.v[0], &c.v[1], &c.v[2]);
+            if (n < 3) Panic("%s:%d: bad vertex\n", filename, lineno);
+            *(vec4*)array_add(&positions) = a;
+            *(vec4*)array_add(&colors) = c;
+        } else if (strncmp(line, "vt ", 3) == 0) {
+            if (sscanf(line + 3, "%f %f", &a.v[0], &a.v[1]) < 1) {
+                Panic("%s:%d: bad texture coordinate\n", filename, lineno);
+            }
+            *(vec4*)array_add(&uvs) = a;
+        } else if (strncmp(line, "vn ", 3) == 0) {
+            if (sscanf(line + 3, "%f %f %f", &a.v[0], &a.v[1], &a.v[2]) != 3) {
+                Panic("%s:%d: bad normal\n", filename, lineno);
+            }
+            *(vec4*)array_add(&normals) = a;
+        } else if (strncmp(line, "f ", 2) == 0) {
+            parse_face(line + 2, lineno);
+        }
+    }
+    fclose(f);
+
+    for (size_t i = 0; i < vertices.count; i++) {
+        mesh_vertex *v = array_get(&vertices, i);
+        float l = sqrtf(v->norm[0] * v->norm[0] + v->norm[1] * v->norm[1] +
+            v->norm[2] * v->norm[2]);
+        if (l > 0) for (int j = 0; j < 3; j++) v->norm[j] /= l;
+    }
+}
+
+/*
+ * optimize the mesh before quantization
+ */
+
+static void optimize()
+{
+    uint32_t *idx = (uint32_t*)indices.arr;
+    uint32_t vertex_count = (uint32_t)vertices.count;
+    float acmr = mesh_acmr(idx, indices.count, vertex_count, MESH_FIFO_SIZE);
+
+    vertex_count = mesh_weld_vertices(idx, indices.count, vertices.arr,
+        vertex_count, sizeof(mesh_vertex));
+    mesh_optimize_vertex_cache(idx, indices.count, vertex_count);
+    if (optimize_overdraw) {
+        mesh_optimize_overdraw(idx, indices.count, vertices.arr,
+            vertex_count, sizeof(mesh_vertex), 1.05f);
+    }
+    vertex_count = mesh_optimize_vertex_fetch(idx, indices.count,
+        vertices.arr, vertex_count, sizeof(mesh_vertex));
+
+    printf("%s: vertices %zu -> %u, acmr %.3f -> %.3f\n", input_filename,
+        vertices.count, vertex_count, acmr,
+        mesh_acmr(idx, indices.count, vertex_count, MESH_FIFO_SIZE));
+    vertices.count = vertex_count;
+}
+
+/*
+ * write the mesh file
+ */
+
+static uint32_t mesh_layout(mesh_file_attr *attrs)
+{
+    if (use_float) {
+        attrs[0] = (mesh_file_attr){ mesh_attr_pos, mesh_format_float3, 0 };
+        attrs[1] = (mesh_file_attr){ mesh_attr_normal, mesh_format_float3, 12 };
+        attrs[2] = (mesh_file_attr){ mesh_attr_uv, mesh_format_float2, 24 };
+        attrs[3] = (mesh_file_attr){ mesh_attr_color, mesh_format_float4, 32 };
+        return 48;
+    } else {
+        attrs[0] = (mesh_file_attr){ mesh_attr_pos, mesh_format_float3, 0 };
+        attrs[1] = (mesh_file_attr){ mesh_attr_normal, mesh_format_snorm10x3, 12 };
+        attrs[2] = (mesh_file_attr){ mesh_attr_uv, mesh_format_half2, 16 };
+        attrs[3] = (mesh_file_attr){ mesh_attr_color, mesh_format_unorm8x4, 20 };
+        return 24;
+    }
+}
+
+static void mesh_pack_vertex(char *out, mesh_vertex *v)
+{
+    if (use_float) {
+        memcpy(out, v->pos, 12);
+        memcpy(out + 12, v->norm, 12);
+        memcpy(out + 24, v->uv, 8);
+        memcpy(out + 32, v->col, 16);
+    } else {
+        uint16_t uv[2] = {
+            mesh_float_to_half(v->uv[0]), mesh_float_to_half(v->uv[1])
+        };
+        uint32_t n = mesh_pack_snorm10x3(v->norm[0], v->norm[1], v->norm[2]);
+        uint32_t c = mesh_pack_unorm8x4(v->col[0], v->col[1], v->col[2], v->col[3]);
+        memcpy(out, v->pos, 12);
+        memcpy(out + 12, &n, 4);
+        memcpy(out + 16, uv, 4);
+        memcpy(out + 20, &c, 4);
+    }
+}
+
+static void write_padding(FILE *f, size_t *offset)
+{
+    static const char zero[MESH_FILE_ALIGN];
+    size_t aligned = mesh_file_align(*offset);
+    fwrite(zero, 1, aligned - *offset, f);
+    *offset = aligned;
+}
+
+static void write_mesh(const char *filename)
+{
+    mesh_file_header hdr;
+    mesh_file_attr attrs[4];
+    size_t offset;
+    FILE *f;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = MESH_FILE_MAGIC;
+    hdr.version = MESH_FILE_VERSION;
+    hdr.attr_count = 4;
+    hdr.vertex_count = (uint32_t)vertices.count;
+    hdr.vertex_stride = mesh_layout(attrs);
+    hdr.index_count = (uint32_t)indices.count;
+    hdr.index_type = vertices.count <= 65536 ? mesh_index_u16 : mesh_index_u32;
+
+    for (int i = 0; i < 3; i++) {
+        hdr.bounds_min[i] = INFINITY;
+        hdr.bounds_max[i] = -INFINITY;
+    }
+    for (size_t i = 0; i < vertices.count; i++) {
+        mesh_vertex *v = array_get(&vertices, i);
+        for (int j = 0; j < 3; j++) {
+            if (v->pos[j] < hdr.bounds_min[j]) hdr.bounds_min[j] = v->pos[j];
+            if (v->pos[j] > hdr.bounds_max[j]) hdr.bounds_max[j] = v->pos[j];
+        }
+    }
+
+    offset = sizeof(hdr) + sizeof(attrs);
+    hdr.vertex_offset = mesh_file_align(offset);
+    hdr.index_offset = mesh_file_align(hdr.vertex_offset +
+        (size_t)hdr.vertex_count * hdr.vertex_stride);
+
+    if ((f = fopen(filename, "wb")) == NULL) {
+        Panic("cannot open: %s: %s\n", filename, strerror(errno));
+    }
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fwrite(attrs, sizeof(attrs), 1, f);
+    write_padding(f, &offset);
+
+    char vbuf[64];
+    for (size_t i = 0; i < vertices.count; i++) {
+        mesh_pack_vertex(vbuf, array_get(&vertices, i));
+        fwrite(vbuf, hdr.vertex_stride, 1, f);
+    }
+    offset += (size_t)hdr.vertex_count * hdr.vertex_stride;
+    write_padding(f, &offset);
+
+    for (size_t i = 0; i < indices.count; i++) {
+        uint32_t idx = *(uint32_t*)array_get(&indices, i);
+        if (hdr.index_type == mesh_index_u16) {
+            uint16_t idx16 = (uint16_t)idx;
+            fwrite(&idx16, sizeof(idx16), 1, f);
+        } else {
+            fwrite(&idx, sizeof(idx), 1, f);
+        }
+    }
+    offset += indices.count * mesh_index_size(hdr.index_type);
+
+    if (fclose(f) != 0) {
+        Panic("cannot write: %s: %s\n", filename, strerror(errno));
+    }
+
+    printf("%s: vertices=%u indices=%u stride=%u index_size=%zu bytes=%zu\n",
+        filename, hdr.vertex_count, hdr.index_count, hdr.vertex_stride,
+        mesh_index_size(hdr.index_type), offset);
+}
+
+/*
+ * command line
+ */
+
+static void print_usage_and_exit(const char *argv0)
+{
+    fprintf(stderr, "\nusage: %s [options] <file.obj>\n\n"
+                    "-h, --help              print this help message\n"
+                    "-o, --output <file>     output mesh file\n"
+                    "-F, --float             write unquantized float attributes\n"
+                    "-O, --optimize          optimize for vertex cache and fetch\n"
+                    "-z, --overdraw          also optimize for overdraw\n\n",
+        argv0);
+    exit(9);
+}
+
+static bool match_option(const char *arg, const char *opt, const char *longopt)
+{
+    return strcmp(arg, opt) == 0 || strcmp(arg, longopt) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool help = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (match_option(argv[i], "-h", "--help")) {
+            help = true;
+        } else if (match_option(argv[i], "-o", "--output") && i+1 < argc) {
+            output_filename = argv[++i];
+        } else if (match_option(argv[i], "-F", "--float")) {
+            use_float = true;
+        } else if (match_option(argv[i], "-O", "--optimize")) {
+            optimize_mesh = true;
+        } else if (match_option(argv[i], "-z", "--overdraw")) {
+            optimize_mesh = optimize_overdraw = true;
+        } else if (argv[i][0] != '-' && !input_filename) {
+            input_filename = argv[i];
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            help = true;
+        }
+    }
+
+    if (help || !input_filename || !output_filename) {
+        print_usage_and_exit(argv[0]);
+    }
+
+    array_init(&positions, sizeof(vec4));
+    array_init(&colors, sizeof(vec4));
+    array_init(&uvs, sizeof(vec4));
+    array_init(&normals, sizeof(vec4));
+    array_init(&vertices, sizeof(mesh_vertex));
+    array_init(&indices, sizeof(uint32_t));
+
+    parse_obj(input_filename);
+    if (indices.count == 0) Panic("%s: no faces\n", input_filename);
+    if (optimize_mesh) optimize();
+    write_mesh(output_filename);
+
+    return 0;
+}
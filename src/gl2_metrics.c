@@ -0,0 +1,119 @@
+/*
+ * gl2_metrics
+ *
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "frame_metrics.h"
+
+#define Panic(...) { fprintf(stderr, __VA_ARGS__); exit(9); }
+
+typedef unsigned long ulong;
+
+/*
+ * scrape a live metrics file, printing one JSON object per window
+ * for each sample
+ */
+
+static void print_snapshot(frame_metrics *fm)
+{
+    frame_metrics_window windows[FRAME_METRICS_MAX_WINDOWS];
+    int n = frame_metrics_snapshot(fm, windows);
+
+    for (int i = 0; i < n; i++) {
+        frame_metrics_window *mw = &windows[i];
+        printf("{\"window\":%d,\"frames\":%lu,\"sync_serial\":%lu,"
+            "\"update_time\":%ld,\"width\":%d,\"height\":%d",
+            i, (ulong)mw->frames, (ulong)mw->sync_serial,
+            (long)mw->update_time, mw->width, mw->height);
+        for (int j = 0; j < metrics_series_count; j++) {
+            frame_metrics_series *ms = &mw->series[j];
+            printf(",\"%s\":{\"count\":%lu,\"last\":%ld,\"min\":%ld,"
+                "\"p50\":%ld,\"p95\":%ld,\"p99\":%ld,\"max\":%ld,"
+                "\"mean\":%ld}", frame_metrics_series_names[j],
+                (ulong)ms->count, (long)ms->last, (long)ms->min,
+                (long)ms->p50, (long)ms->p95, (long)ms->p99,
+                (long)ms->max, (long)ms->mean);
+        }
+        printf("}\n");
+    }
+    fflush(stdout);
+}
+
+static int print_usage_and_exit(const char *argv0)
+{
+    fprintf(stderr, "\nusage: %s [options] <metrics-file>\n\n"
+                    "-h, --help                  print this help message\n"
+                    "-w, --watch <ms>            sample every interval\n"
+                    "-n, --samples <count>       samples when watching (default unlimited)\n\n",
+        argv0);
+    exit(9);
+}
+
+static bool match_option(const char *arg, const char *opt, const char *longopt)
+{
+    return strcmp(arg, opt) == 0 || strcmp(arg, longopt) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *filename = NULL;
+    ulong watch_interval = 0, samples = 0;
+    bool help = false;
+    frame_metrics fm = { 0 };
+
+    for (int i = 1; i < argc; i++) {
+        if (match_option(argv[i], "-h", "--help")) {
+            help = true;
+        } else if (match_option(argv[i], "-w", "--watch") && i+1 < argc) {
+            watch_interval = strtoul(argv[++i], NULL, 10);
+        } else if (match_option(argv[i], "-n", "--samples") && i+1 < argc) {
+            samples = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && !filename) {
+            filename = argv[i];
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            help = true;
+        }
+    }
+
+    if (help || !filename) print_usage_and_exit(argv[0]);
+
+    errno = 0;
+    if (frame_metrics_open(&fm, filename) < 0) {
+        Panic("cannot open metrics: %s: %s\n", filename,
+            errno ? strerror(errno) : "invalid metrics");
+    }
+
+    for (ulong i = 0; ; i++) {
+        print_snapshot(&fm);
+        if (watch_interval == 0 || (samples && i + 1 >= samples)) break;
+        struct timespec ts = {
+            (time_t)(watch_interval / 1000),
+            (long)(watch_interval % 1000) * 1000000L
+        };
+        nanosleep(&ts, NULL);
+    }
+
+    frame_metrics_close(&fm);
+
+    return 0;
+}
@@ -0,0 +1,430 @@
+/*
+ * gl2_trace_report
+ *
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "frame_trace.h"
+
+#define Panic(...) { fprintf(stderr, __VA_ARGS__); exit(9); }
+
+typedef unsigned long ulong;
+
+/*
+ * frames reconstructed from trace records
+ */
+
+typedef struct {
+    uint64_t frame_number;
+    int disposition;
+    int64_t begin_time;
+    int64_t end_time;
+    uint64_t sync_serial;
+    int64_t drawn_time;
+    int64_t presentation_offset;
+    int64_t refresh_interval;
+} trace_frame;
+
+typedef struct {
+    trace_frame *arr;
+    size_t count;
+    size_t capacity;
+    size_t polls;
+    size_t delays;
+    size_t urgent;
+    size_t configures;
+    size_t sync_requests;
+    size_t events[256];
+    int64_t start_time;
+    int64_t end_time;
+} trace_summary;
+
+enum { FRAME_MATCH_WINDOW = 64 };
+
+static trace_frame* find_frame(trace_summary *ts, uint64_t sync_serial)
+{
+    size_t limit = ts->count < FRAME_MATCH_WINDOW ? ts->count : FRAME_MATCH_WINDOW;
+    for (size_t i = 0; i < limit; i++) {
+        trace_frame *f = &ts->arr[ts->count - i - 1];
+        if (f->sync_serial == sync_serial) return f;
+    }
+    return NULL;
+}
+
+/*
+ * frames are reconstructed for one window, as sync serials are per window.
+ * polls and events without a window are counted for every window.
+ */
+static void add_record(trace_summary *ts, frame_trace_record *r,
+    uint32_t window)
+{
+    trace_frame *f;
+
+    if (r->window != FRAME_TRACE_NO_WINDOW && r->window != window) return;
+
+    if (ts->start_time == 0) ts->start_time = r->time;
+    if (r->time > ts->end_time) ts->end_time = r->time;
+
+    switch (r->type) {
+    case trace_poll:
+        ts->polls++;
+        break;
+    case trace_event:
+        ts->events[r->flags & 0xff]++;
+        break;
+    case trace_delay:
+        ts->delays++;
+        break;
+    case trace_frame_begin:
+        if (ts->count == ts->capacity) {
+            ts->capacity = ts->capacity ? ts->capacity << 1 : 1024;
+            ts->arr = (trace_frame*)realloc(ts->arr,
+                ts->capacity * sizeof(trace_frame));
+        }
+        f = &ts->arr[ts->count++];
+        memset(f, 0, sizeof(*f));
+        f->frame_number = r->frame_number;
+        f->disposition = r->flags;
+        f->begin_time = r->time;
+        if (r->flags) ts->urgent++;
+        break;
+    case trace_frame_end:
+        if (ts->count > 0) {
+            f = &ts->arr[ts->count - 1];
+            f->end_time = r->time;
+            f->sync_serial = r->arg[0];
+        }
+        break;
+    case trace_sync_request:
+        ts->sync_requests++;
+        break;
+    case trace_configure:
+        ts->configures++;
+        break;
+    case trace_frame_drawn:
+        if ((f = find_frame(ts, r->arg[0]))) {
+            f->drawn_time = (int64_t)r->arg[1];
+        }
+        break;
+    case trace_frame_timings:
+        if ((f = find_frame(ts, r->arg[0]))) {
+            f->presentation_offset = (int64_t)r->arg[1];
+            f->refresh_interval = (int64_t)(uint32_t)r->arg[2];
+        }
+        break;
+    }
+}
+
+/*
+ * summary statistics
+ */
+
+typedef struct {
+    long *arr;
+    size_t count;
+} sample_set;
+
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long*)a, y = *(const long*)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static void sample_set_init(sample_set *ss, size_t capacity)
+{
+    ss->arr = (long*)malloc((capacity ? capacity : 1) * sizeof(long));
+    ss->count = 0;
+}
+
+static void print_samples(const char *name, sample_set *ss)
+{
+    double sum = 0, sum_sq = 0;
+
+    if (ss->count == 0) {
+        printf("%-24s count=0\n", name);
+        return;
+    }
+
+    qsort(ss->arr, ss->count, sizeof(long), compare_long);
+    for (size_t i = 0; i < ss->count; i++) {
+        sum += ss->arr[i];
+        sum_sq += (double)ss->arr[i] * ss->arr[i];
+    }
+    double mean = sum / ss->count;
+    double var = ss->count > 1 ? (sum_sq - mean * sum) / (ss->count - 1) : 0;
+
+    #define pct(p) ss->arr[((p) * ss->count + 99) / 100 - 1]
+    printf("%-24s count=%zu min=%ld p50=%ld p95=%ld p99=%ld max=%ld "
+        "mean=%.1f stddev=%.1f\n", name, ss->count, ss->arr[0],
+        pct(50), pct(95), pct(99), ss->arr[ss->count - 1],
+        mean, sqrt(var > 0 ? var : 0));
+    #undef pct
+}
+
+static void print_summary(trace_summary *ts)
+{
+    sample_set frame_time, render_time, latency, present_latency;
+    sample_set refresh_interval, phase;
+
+    sample_set_init(&frame_time, ts->count);
+    sample_set_init(&render_time, ts->count);
+    sample_set_init(&latency, ts->count);
+    sample_set_init(&present_latency, ts->count);
+    sample_set_init(&refresh_interval, ts->count);
+    sample_set_init(&phase, ts->count);
+
+    for (size_t i = 0; i < ts->count; i++) {
+        trace_frame *f = &ts->arr[i];
+        if (i > 0) {
+            frame_time.arr[frame_time.count++] =
+                f->begin_time - ts->arr[i - 1].begin_time;
+        }
+        if (f->end_time) {
+            render_time.arr[render_time.count++] = f->end_time - f->begin_time;
+        }
+        if (f->drawn_time) {
+            latency.arr[latency.count++] = f->drawn_time - f->begin_time;
+        }
+        if (f->drawn_time && f->presentation_offset) {
+            int64_t presented = f->drawn_time + f->presentation_offset;
+            present_latency.arr[present_latency.count++] =
+                presented - f->begin_time;
+            /* offset of frame start (XFlush) before the vblank it hit */
+            if (f->refresh_interval > 0) {
+                phase.arr[phase.count++] =
+                    (presented - f->begin_time) % f->refresh_interval;
+            }
+        }
+        if (f->refresh_interval) {
+            refresh_interval.arr[refresh_interval.count++] = f->refresh_interval;
+        }
+    }
+
+    double duration = (ts->end_time - ts->start_time) / 1e6;
+
+    printf("duration                 %.3f s\n", duration);
+    printf("frames                   %zu (%.2f fps)\n", ts->count,
+        duration > 0 ? ts->count / duration : 0);
+    printf("urgent_frames            %zu\n", ts->urgent);
+    printf("delays                   %zu\n", ts->delays);
+    printf("polls                    %zu\n", ts->polls);
+    printf("configures               %zu\n", ts->configures);
+    printf("sync_requests            %zu\n", ts->sync_requests);
+    print_samples("frame_time", &frame_time);
+    print_samples("render_time", &render_time);
+    print_samples("compositor_latency", &latency);
+    print_samples("presentation_latency", &present_latency);
+    print_samples("refresh_interval", &refresh_interval);
+    print_samples("xflush_vblank_offset", &phase);
+
+    for (size_t i = 0; i < 256; i++) {
+        if (ts->events[i]) printf("event_type_%-13zu %zu\n", i, ts->events[i]);
+    }
+
+    free(frame_time.arr);
+    free(render_time.arr);
+    free(latency.arr);
+    free(present_latency.arr);
+    free(refresh_interval.arr);
+    free(phase.arr);
+}
+
+/*
+ * SVG charts in the style of images/frame-offset.png and xflush-offset.png
+ */
+
+enum { CHART_WIDTH = 2000, CHART_MARGIN = 160, CHART_FRAME_Y = 360 };
+
+static void chart_begin(FILE *f, const char *title, const char *subtitle)
+{
+    fprintf(f, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" "
+        "height=\"600\" font-family=\"Helvetica, Arial, sans-serif\">\n"
+        "<rect width=\"100%%\" height=\"100%%\" fill=\"white\"/>\n"
+        "<text x=\"%d\" y=\"190\" font-size=\"44\" font-weight=\"bold\" "
+        "text-anchor=\"middle\">%s</text>\n"
+        "<text x=\"%d\" y=\"300\" font-size=\"40\" font-style=\"italic\" "
+        "text-anchor=\"middle\">%s</text>\n",
+        CHART_WIDTH, CHART_WIDTH / 2, title, CHART_WIDTH / 2, subtitle);
+}
+
+static void chart_frames(FILE *f, trace_summary *ts, size_t start,
+    size_t count, bool xflush)
+{
+    trace_frame *first = &ts->arr[start];
+    trace_frame *last = &ts->arr[start + count - 1];
+    int64_t t0 = first->begin_time;
+    int64_t t1 = last->end_time > last->begin_time ? last->end_time :
+        last->begin_time + 1;
+    if (start + count < ts->count) t1 = ts->arr[start + count].begin_time;
+    double scale = (double)(CHART_WIDTH - 2 * CHART_MARGIN) / (t1 - t0);
+
+    for (size_t i = start; i < start + count; i++) {
+        trace_frame *fr = &ts->arr[i];
+        int64_t next = i + 1 < ts->count ? ts->arr[i + 1].begin_time : t1;
+        double x0 = CHART_MARGIN + (fr->begin_time - t0) * scale;
+        double x1 = CHART_MARGIN + (next - t0) * scale;
+        double x2 = CHART_MARGIN + ((fr->end_time ? fr->end_time : next) - t0) * scale;
+        fprintf(f, "<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"100\" "
+            "rx=\"20\" fill=\"white\" stroke=\"black\" stroke-width=\"3\"/>\n",
+            x0, CHART_FRAME_Y - 50, x1 - x0);
+        fprintf(f, "<text x=\"%.1f\" y=\"%d\" font-size=\"28\">frame #%lu</text>\n",
+            x0 + 14, CHART_FRAME_Y - 12, (ulong)fr->frame_number);
+        fprintf(f, "<rect x=\"%.1f\" y=\"%d\" width=\"%.1f\" height=\"50\" "
+            "rx=\"20\" fill=\"#d6d6d6\" stroke=\"black\" stroke-width=\"3\"/>\n",
+            x0, CHART_FRAME_Y, x2 - x0);
+        fprintf(f, "<text x=\"%.1f\" y=\"%d\" font-size=\"24\" "
+            "text-anchor=\"middle\">draw(%s)</text>\n", (x0 + x2) / 2,
+            CHART_FRAME_Y + 34, fr->disposition ? "urgent" : "normal");
+        if (xflush) {
+            fprintf(f, "<line x1=\"%.1f\" y1=\"%d\" x2=\"%.1f\" y2=\"%d\" "
+                "stroke=\"black\" stroke-width=\"3\"/>\n",
+                x0, CHART_FRAME_Y + 70, x0, CHART_FRAME_Y + 130);
+            fprintf(f, "<text x=\"%.1f\" y=\"%d\" font-size=\"40\" "
+                "text-anchor=\"middle\">XFlush</text>\n", x0, CHART_FRAME_Y + 190);
+            if (fr->drawn_time && fr->presentation_offset) {
+                fprintf(f, "<text x=\"%.1f\" y=\"%d\" font-size=\"22\" "
+                    "text-anchor=\"middle\">-%ldus</text>\n", x0,
+                    CHART_FRAME_Y + 225, (long)(fr->drawn_time +
+                    fr->presentation_offset - fr->begin_time));
+            }
+        }
+    }
+}
+
+static void chart_end(FILE *f)
+{
+    fprintf(f, "</svg>\n");
+}
+
+static void write_chart(const char *filename, trace_summary *ts,
+    size_t start, size_t count, bool xflush)
+{
+    FILE *f;
+
+    if (start >= ts->count) {
+        Panic("chart start frame %zu out of range (%zu frames)\n",
+            start, ts->count);
+    }
+    if (start + count > ts->count) count = ts->count - start;
+
+    if ((f = fopen(filename, "w")) == NULL) {
+        Panic("fopen: %s: %s\n", filename, strerror(errno));
+    }
+    if (xflush) {
+        chart_begin(f, "XFlush", "XFlush time offset subject to variable draw times");
+    } else {
+        chart_begin(f, "Frame Flow Control", "draw time and frame time offsets");
+    }
+    chart_frames(f, ts, start, count, xflush);
+    chart_end(f);
+    fclose(f);
+}
+
+/*
+ * gl2_trace_report
+ */
+
+static void print_records(frame_trace *ft)
+{
+    for (uint64_t i = frame_trace_first(ft); i < frame_trace_last(ft); i++) {
+        frame_trace_record *r = frame_trace_get(ft, i);
+        printf("[%lu/%ld] %s window=%d flags=%u arg0=%lu arg1=%lu arg2=%lu\n",
+            (ulong)r->frame_number, (long)r->time,
+            r->type < trace_type_count ? frame_trace_type_names[r->type] : "?",
+            r->window == FRAME_TRACE_NO_WINDOW ? -1 : (int)r->window,
+            r->flags, (ulong)r->arg[0], (ulong)r->arg[1], (ulong)r->arg[2]);
+    }
+}
+
+static int print_usage_and_exit(const char *argv0)
+{
+    fprintf(stderr, "\nusage: %s [options] <trace-file>\n\n"
+                    "-h, --help                  print this help message\n"
+                    "-d, --dump                  print all trace records\n"
+                    "-w, --window <index>        report frames of window (default 0)\n"
+                    "-f, --frame-offset <svg>    write frame offset chart\n"
+                    "-x, --xflush-offset <svg>   write xflush offset chart\n"
+                    "-s, --start <frame>         first charted frame (default 0)\n"
+                    "-n, --frames <count>        charted frames (default 4)\n\n",
+        argv0);
+    exit(9);
+}
+
+static bool match_option(const char *arg, const char *opt, const char *longopt)
+{
+    return strcmp(arg, opt) == 0 || strcmp(arg, longopt) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *filename = NULL, *frame_chart = NULL, *xflush_chart = NULL;
+    size_t chart_start = 0, chart_frames = 4;
+    uint32_t window = 0;
+    bool help = false, dump = false;
+    trace_summary ts = { 0 };
+    frame_trace ft = { 0 };
+
+    for (int i = 1; i < argc; i++) {
+        if (match_option(argv[i], "-h", "--help")) {
+            help = true;
+        } else if (match_option(argv[i], "-d", "--dump")) {
+            dump = true;
+        } else if (match_option(argv[i], "-w", "--window") && i+1 < argc) {
+            window = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (match_option(argv[i], "-f", "--frame-offset") && i+1 < argc) {
+            frame_chart = argv[++i];
+        } else if (match_option(argv[i], "-x", "--xflush-offset") && i+1 < argc) {
+            xflush_chart = argv[++i];
+        } else if (match_option(argv[i], "-s", "--start") && i+1 < argc) {
+            chart_start = strtoul(argv[++i], NULL, 10);
+        } else if (match_option(argv[i], "-n", "--frames") && i+1 < argc) {
+            chart_frames = strtoul(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && !filename) {
+            filename = argv[i];
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[i]);
+            help = true;
+        }
+    }
+
+    if (help || !filename || chart_frames == 0) print_usage_and_exit(argv[0]);
+
+    errno = 0;
+    if (frame_trace_open(&ft, filename) < 0) {
+        Panic("cannot open trace: %s: %s\n", filename,
+            errno ? strerror(errno) : "invalid trace");
+    }
+
+    if (dump) print_records(&ft);
+
+    for (uint64_t i = frame_trace_first(&ft); i < frame_trace_last(&ft); i++) {
+        add_record(&ts, frame_trace_get(&ft, i), window);
+    }
+
+    print_summary(&ts);
+    if (frame_chart) write_chart(frame_chart, &ts, chart_start, chart_frames, false);
+    if (xflush_chart) write_chart(xflush_chart, &ts, chart_start, chart_frames, true);
+
+    free(ts.arr);
+    frame_trace_close(&ft);
+
+    return 0;
+}
@@ -65,14 +65,112 @@ typedef struct
     vec4f col;
 } vertex;
 
+typedef struct arena_block
+{
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+} arena_block;
+
+typedef struct
+{
+    arena_block *head;
+    size_t block_size;
+} arena;
+
 typedef struct
 {
     size_t stride;
     size_t capacity;
     size_t count;
     char *data;
+    arena *arena;
 } array_buffer;
 
+typedef struct
+{
+    const char * const *attr_names;
+    GLint *attr_slots;
+    size_t num_attrs;
+    const char * const *uniform_names;
+    GLint *uniform_slots;
+    size_t num_uniforms;
+    const char * const *block_names;
+    GLint *block_slots;
+    size_t num_blocks;
+} program_slots;
+
+typedef struct
+{
+    GLuint program;
+    GLuint vertex_array;
+    GLuint array_buffer;
+    GLuint element_array_buffer;
+} gl_state_cache;
+
+enum { STREAM_BUFFER_REGIONS = 3 };
+
+typedef struct
+{
+    GLuint obj;
+    GLenum target;
+    size_t region_size;
+    size_t offset;
+    uint region;
+    int persistent;
+    char *map;
+    char *range;
+    GLsync fences[STREAM_BUFFER_REGIONS];
+} stream_buffer;
+
+typedef struct
+{
+    GLuint fbo;
+    GLuint color;
+    GLuint depth;
+    int width;
+    int height;
+} render_target;
+
+typedef struct
+{
+    GLenum type;
+    const char *filename;
+} shader_source;
+
+/*
+ * shader variants
+ *
+ * a variant is a list of integer defines that specialize a shader. GLSL
+ * sources receive them as #define directives after #version and SPIR-V
+ * modules receive defines with a constant_id as specialization constants.
+ * a constant_id of -1 applies the define to GLSL only.
+ */
+typedef struct
+{
+    const char *name;
+    int value;
+    int constant_id;
+} shader_define;
+
+typedef struct
+{
+    const shader_define *defines;
+    GLuint num_defines;
+} shader_variant;
+
+typedef struct
+{
+    GLuint magic;
+    GLuint version;
+    GLenum format;
+    GLuint length;
+    unsigned long long key;
+} program_cache_header;
+
+enum { PROGRAM_CACHE_MAGIC = 0x48435250 /* "PRCH" */ };
+enum { PROGRAM_CACHE_VERSION = 1 };
+
 typedef array_buffer vertex_buffer;
 typedef array_buffer index_buffer;
 
@@ -84,21 +182,74 @@ typedef enum
     primitive_topology_quad_strip,
 } primitive_type;
 
+static int map_file(buffer *buf, const char *filename);
+static void unmap_file(buffer *buf);
 static GLuint compile_shader(GLenum type, const char *filename);
+static GLuint compile_shader_variant(GLenum type, const char *filename,
+    const shader_variant *variant);
 static GLuint link_program(const GLuint *shaders, GLuint numshaders,
     GLuint (*bindfn)(GLuint prog));
+static GLuint link_program_slots(const GLuint *shaders, GLuint numshaders,
+    GLuint (*bindfn)(GLuint prog), program_slots *slots);
+static GLuint link_program_cached(const shader_source *sources,
+    GLuint numsources, GLuint (*bindfn)(GLuint prog), program_slots *slots,
+    const char *cache_dir);
+static GLuint link_program_variant(const shader_source *sources,
+    GLuint numsources, const shader_variant *variant,
+    GLuint (*bindfn)(GLuint prog), program_slots *slots,
+    const char *cache_dir);
 static void vertex_buffer_create(GLuint *obj, GLenum target,
     void *data, size_t size);
 static void vertex_array_pointer(const char *attr, GLint size,
     GLenum type, GLboolean norm, size_t stride, size_t offset);
+static void stream_buffer_init(stream_buffer *sb, GLenum target,
+    size_t region_size);
+static void stream_buffer_destroy(stream_buffer *sb);
+static void stream_buffer_begin_frame(stream_buffer *sb);
+static void* stream_buffer_alloc(stream_buffer *sb, size_t size,
+    size_t align, size_t *offset);
+static void stream_buffer_flush(stream_buffer *sb);
+static void stream_buffer_end_frame(stream_buffer *sb);
+static void render_target_resize(render_target *rt, int width, int height);
+static void render_target_destroy(render_target *rt);
+static void render_target_bind(render_target *rt);
+static void render_target_blit(render_target *rt, int width, int height);
 static void vertex_array_1f(const char *attr, float v1);
 static void uniform_1i(const char *uniform, GLint i);
 static void uniform_3f(const char *uniform, GLfloat v1, GLfloat v2, GLfloat v3);
 static void uniform_matrix_4fv(const char *uniform, const GLfloat *mat);
+static void vertex_array_pointer_slot(GLint slot, GLint size,
+    GLenum type, GLboolean norm, size_t stride, size_t offset);
+static void vertex_array_1f_slot(GLint slot, float v1);
+static void vertex_array_divisor_slot(GLint slot, GLuint divisor);
+static void uniform_1i_slot(GLint slot, GLint i);
+static void uniform_3f_slot(GLint slot, GLfloat v1, GLfloat v2, GLfloat v3);
+static void uniform_matrix_4fv_slot(GLint slot, const GLfloat *mat);
+static void uniform_block_range_slot(GLint slot, GLuint buffer,
+    size_t offset, size_t size);
+static size_t uniform_buffer_alignment();
+
+static int gl_check_version(int major, int minor);
+static int gl_check_extension(const char *name);
+static void gl_state_invalidate();
+static void gl_use_program(GLuint program);
+static void gl_bind_vertex_array(GLuint vao);
+static void gl_bind_buffer(GLenum target, GLuint buffer);
+
+static void arena_init(arena *a, size_t block_size);
+static void* arena_alloc(arena *a, size_t size, size_t align);
+static void* arena_resize(arena *a, void *ptr, size_t old_size,
+    size_t new_size, size_t align);
+static void arena_release(arena *a);
 
 static void array_buffer_init(array_buffer *sb,
     size_t stride, size_t capacity);
+static void array_buffer_init_arena(array_buffer *sb,
+    size_t stride, size_t capacity, arena *a);
 static void array_buffer_destroy(array_buffer *sb);
+static void array_buffer_reserve(array_buffer *sb, size_t count);
+static uint array_buffer_append_n(array_buffer *sb, const void *data,
+    size_t count);
 static void* array_buffer_data(array_buffer *sb);
 static size_t array_buffer_size(array_buffer *sb);
 static size_t array_buffer_stride(array_buffer *sb);
@@ -106,14 +257,20 @@ static uint array_buffer_count(array_buffer *sb);
 static uint array_buffer_add(array_buffer *sb, void *data);
 
 static void vertex_buffer_init(vertex_buffer *vb);
+static void vertex_buffer_init_arena(vertex_buffer *vb, arena *a);
 static void vertex_buffer_destroy(vertex_buffer *vb);
+static void vertex_buffer_reserve(vertex_buffer *vb, size_t count);
+static uint vertex_buffer_add_n(vertex_buffer *vb, const vertex *v,
+    size_t count);
 static void* vertex_buffer_data(vertex_buffer *vb);
 static size_t vertex_buffer_size(vertex_buffer *vb);
 static uint vertex_buffer_count(vertex_buffer *vb);
 static uint vertex_buffer_add(vertex_buffer *vb, vertex vertex);
 
 static void index_buffer_init(index_buffer *ib);
+static void index_buffer_init_arena(index_buffer *ib, arena *a);
 static void index_buffer_destroy(index_buffer *ib);
+static void index_buffer_reserve(index_buffer *ib, size_t count);
 static void* index_buffer_data(index_buffer *ib);
 static size_t index_buffer_size(index_buffer *ib);
 static uint index_buffer_count(index_buffer *ib);
@@ -122,25 +279,140 @@ static void index_buffer_add(index_buffer *ib,
 static void index_buffer_add_primitves(index_buffer *ib,
     primitive_type type, uint count, uint addend);
 
+/*
+ * arena allocator
+ *
+ * allocations are carved from a list of blocks and released together.
+ * the most recent allocation in the current block can be resized in place,
+ * so a buffer that grows while nothing else is allocated is not copied.
+ */
+
+enum { ARENA_ALIGN = 16 };
+
+static void arena_init(arena *a, size_t block_size)
+{
+    a->head = NULL;
+    a->block_size = block_size;
+}
+
+static char* arena_block_data(arena_block *b)
+{
+    return (char*)(b + 1);
+}
+
+static size_t arena_align_offset(arena_block *b, size_t align)
+{
+    uintptr_t p = (uintptr_t)(arena_block_data(b) + b->used);
+    return b->used + (((p + align - 1) & ~(uintptr_t)(align - 1)) - p);
+}
+
+static void* arena_alloc(arena *a, size_t size, size_t align)
+{
+    arena_block *b = a->head;
+    size_t offset;
+
+    if (!b || (offset = arena_align_offset(b, align)) + size > b->size) {
+        size_t block_size = size + align > a->block_size ?
+            size + align : a->block_size;
+        b = (arena_block*)malloc(sizeof(arena_block) + block_size);
+        b->next = a->head;
+        b->size = block_size;
+        b->used = 0;
+        a->head = b;
+        offset = arena_align_offset(b, align);
+    }
+    b->used = offset + size;
+    return arena_block_data(b) + offset;
+}
+
+static void* arena_resize(arena *a, void *ptr, size_t old_size,
+    size_t new_size, size_t align)
+{
+    arena_block *b = a->head;
+
+    if (ptr && b && (char*)ptr + old_size == arena_block_data(b) + b->used &&
+        (char*)ptr - arena_block_data(b) + new_size <= b->size) {
+        b->used = (char*)ptr - arena_block_data(b) + new_size;
+        return ptr;
+    }
+    void *new_ptr = arena_alloc(a, new_size, align);
+    if (ptr) memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    return new_ptr;
+}
+
+static void arena_release(arena *a)
+{
+    arena_block *b = a->head;
+    while (b) {
+        arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+}
+
 /*
  * vertex, index and generic array buffer implementation
+ *
+ * buffers are allocated with malloc or from an arena. arena buffers are
+ * not freed by array_buffer_destroy and are released with the arena.
  */
 
 enum { VERTEX_BUFFER_INITIAL_COUNT = 16 };
 enum { INDEX_BUFFER_INITIAL_COUNT = 64 };
 
-static void array_buffer_init(array_buffer *sb, size_t stride, size_t capacity)
+static void array_buffer_resize(array_buffer *sb, size_t capacity)
 {
-    sb->stride = stride;
+    if (sb->arena) {
+        sb->data = (char*)arena_resize(sb->arena, sb->data,
+            sb->stride * sb->capacity, sb->stride * capacity, ARENA_ALIGN);
+    } else {
+        sb->data = (char*)realloc(sb->data, sb->stride * capacity);
+    }
     sb->capacity = capacity;
+}
+
+static void array_buffer_init_arena(array_buffer *sb,
+    size_t stride, size_t capacity, arena *a)
+{
+    sb->stride = stride;
+    sb->capacity = 0;
     sb->count = 0;
-    sb->data = (char*)malloc(sb->stride * sb->capacity);
+    sb->data = NULL;
+    sb->arena = a;
+    array_buffer_resize(sb, capacity);
+}
+
+static void array_buffer_init(array_buffer *sb, size_t stride, size_t capacity)
+{
+    array_buffer_init_arena(sb, stride, capacity, NULL);
 }
 
 static void array_buffer_destroy(array_buffer *sb)
 {
-    free(sb->data);
+    if (!sb->arena) free(sb->data);
     sb->data = NULL;
+    sb->capacity = sb->count = 0;
+}
+
+/*
+ * grow capacity to exactly count elements if it is smaller
+ */
+static void array_buffer_reserve(array_buffer *sb, size_t count)
+{
+    if (count > sb->capacity) array_buffer_resize(sb, count);
+}
+
+/*
+ * grow capacity by doubling to at least count elements
+ */
+static void array_buffer_grow(array_buffer *sb, size_t count)
+{
+    if (count > sb->capacity) {
+        size_t capacity = sb->capacity ? sb->capacity : 1;
+        while (capacity < count) capacity <<= 1;
+        array_buffer_resize(sb, capacity);
+    }
 }
 
 static uint array_buffer_count(array_buffer *sb)
@@ -165,20 +437,40 @@ static size_t array_buffer_size(array_buffer *sb)
 
 static uint array_buffer_add(array_buffer *sb, void *data)
 {
-    if (sb->count >= sb->capacity) {
-        sb->capacity <<= 1;
-        sb->data = (char*)realloc(sb->data, sb->stride * sb->capacity);
-    }
+    array_buffer_grow(sb, sb->count + 1);
     uint idx = sb->count++;
     memcpy(sb->data + (idx * sb->stride), data, sb->stride);
     return idx;
 }
 
+/*
+ * append count elements with one copy, returns the index of the first
+ */
+static uint array_buffer_append_n(array_buffer *sb, const void *data,
+    size_t count)
+{
+    array_buffer_grow(sb, sb->count + count);
+    uint idx = sb->count;
+    memcpy(sb->data + (idx * sb->stride), data, sb->stride * count);
+    sb->count += count;
+    return idx;
+}
+
 static void vertex_buffer_init(vertex_buffer *vb)
 {
     array_buffer_init(vb, sizeof(vertex), VERTEX_BUFFER_INITIAL_COUNT);
 }
 
+static void vertex_buffer_init_arena(vertex_buffer *vb, arena *a)
+{
+    array_buffer_init_arena(vb, sizeof(vertex), VERTEX_BUFFER_INITIAL_COUNT, a);
+}
+
+static void vertex_buffer_reserve(vertex_buffer *vb, size_t count)
+{
+    array_buffer_reserve(vb, count);
+}
+
 static void vertex_buffer_destroy(vertex_buffer *vb)
 {
     array_buffer_destroy(vb);
@@ -204,6 +496,12 @@ static uint vertex_buffer_add(vertex_buffer *vb, vertex v)
     return array_buffer_add(vb, &v);
 }
 
+static uint vertex_buffer_add_n(vertex_buffer *vb, const vertex *v,
+    size_t count)
+{
+    return array_buffer_append_n(vb, v, count);
+}
+
 static void vertex_buffer_dump(vertex_buffer *vb)
 {
     size_t count = vb->count;
@@ -228,6 +526,16 @@ static void index_buffer_init(index_buffer *ib)
     return array_buffer_init(ib, sizeof(uint), INDEX_BUFFER_INITIAL_COUNT);
 }
 
+static void index_buffer_init_arena(index_buffer *ib, arena *a)
+{
+    return array_buffer_init_arena(ib, sizeof(uint), INDEX_BUFFER_INITIAL_COUNT, a);
+}
+
+static void index_buffer_reserve(index_buffer *ib, size_t count)
+{
+    array_buffer_reserve(ib, count);
+}
+
 static void index_buffer_destroy(index_buffer *ib)
 {
     return array_buffer_destroy(ib);
@@ -251,11 +559,7 @@ static size_t index_buffer_size(index_buffer *ib)
 static void index_buffer_add(index_buffer *ib,
     const uint *data, uint count, uint addend)
 {
-    if (ib->count + count >= ib->capacity) {
-        do { ib->capacity <<= 1; }
-        while (ib->count + count > ib->capacity);
-        ib->data = realloc(ib->data, sizeof(uint) * ib->capacity);
-    }
+    array_buffer_grow(ib, ib->count + count);
     for (uint i = 0; i < count; i++) {
         ((uint*)ib->data)[ib->count++] = data[i] + addend;
     }
@@ -268,6 +572,10 @@ static void index_buffer_add_primitves(index_buffer *ib,
     static const uint tri_strip[] = {0,1,2,2,1,3};
     static const uint quads[] = {0,1,2,0,2,3};
 
+    array_buffer_grow(ib, ib->count + count *
+        (type == primitive_topology_triangles ||
+         type == primitive_topology_triangle_strip ? 3 : 6));
+
     switch (type) {
     case primitive_topology_triangles:
         for (size_t i = 0; i < count; i++) {
@@ -339,7 +647,7 @@ static GLuint attr_list_set(attr_list *list, const char*name, GLuint val)
         list->arr = (attr_val*)malloc(list->size * sizeof(attr_val));
     }
     if (list->count == list->size) {
-        list->count <<= 1;
+        list->size <<= 1;
         list->arr = (attr_val*)realloc(list->arr, list->size * sizeof(attr_val));
     }
     idx = list->count++;
@@ -348,34 +656,136 @@ found:
     return (list->arr[idx].val = val);
 }
 
+/*
+ * GL version and extension queries
+ */
+
+static int gl_check_version(int major, int minor)
+{
+    int gl_major = 0, gl_minor = 0;
+    const char *version = (const char*)glGetString(GL_VERSION);
+    if (version) sscanf(version, "%d.%d", &gl_major, &gl_minor);
+    return gl_major > major || (gl_major == major && gl_minor >= minor);
+}
+
+static int gl_check_extension(const char *name)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char *ext = (const char*)glGetStringi(GL_EXTENSIONS, i);
+        if (ext && strcmp(ext, name) == 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * GL state cache
+ *
+ * skips redundant program, vertex array and buffer binds. the element
+ * array buffer binding is vertex array object state so it is forgotten
+ * when the vertex array changes. callers that bind state directly must
+ * call gl_state_invalidate.
+ */
+
+enum { GL_STATE_UNKNOWN = 0xffffffff };
+
+static gl_state_cache gl_state = {
+    GL_STATE_UNKNOWN, GL_STATE_UNKNOWN, GL_STATE_UNKNOWN, GL_STATE_UNKNOWN
+};
+
+static void gl_state_invalidate()
+{
+    gl_state.program = GL_STATE_UNKNOWN;
+    gl_state.vertex_array = GL_STATE_UNKNOWN;
+    gl_state.array_buffer = GL_STATE_UNKNOWN;
+    gl_state.element_array_buffer = GL_STATE_UNKNOWN;
+}
+
+static void gl_use_program(GLuint program)
+{
+    if (gl_state.program != program) {
+        glUseProgram(program);
+        gl_state.program = program;
+    }
+}
+
+static void gl_bind_vertex_array(GLuint vao)
+{
+    if (gl_state.vertex_array != vao) {
+        glBindVertexArray(vao);
+        gl_state.vertex_array = vao;
+        gl_state.element_array_buffer = GL_STATE_UNKNOWN;
+    }
+}
+
+static void gl_bind_buffer(GLenum target, GLuint buffer)
+{
+    GLuint *cached = NULL;
+
+    switch (target) {
+    case GL_ARRAY_BUFFER: cached = &gl_state.array_buffer; break;
+    case GL_ELEMENT_ARRAY_BUFFER: cached = &gl_state.element_array_buffer; break;
+    }
+    if (!cached) {
+        glBindBuffer(target, buffer);
+    } else if (*cached != buffer) {
+        glBindBuffer(target, buffer);
+        *cached = buffer;
+    }
+}
+
 /*
  * shader utilties
  */
 
-static buffer load_file(const char *filename)
+/*
+ * mapped files
+ *
+ * assets are mapped read-only and private and the mapping is handed to GL
+ * directly, for glShaderSource, glShaderBinary or glBufferData, then
+ * unmapped once the upload returns, as GL copies the data it is given.
+ * empty files are returned with NULL data as zero length maps are invalid.
+ */
+
+static int map_file(buffer *buf, const char *filename)
 {
-    FILE *f;
     struct stat statbuf;
-    char *buf;
-    size_t nread;
+    void *addr = NULL;
+    int fd;
 
-    if ((f = fopen(filename, "r")) == NULL) {
-        printf("load_file: open: %s: %s\n",
-            filename, strerror(errno));
-        exit(1);
+    if ((fd = open(filename, O_RDONLY)) < 0) return -1;
+    if (fstat(fd, &statbuf) < 0) {
+        close(fd);
+        return -1;
     }
-    if (fstat(fileno(f), &statbuf) < 0) {
-        printf("load_file: stat: %s: %s\n",
-            filename, strerror(errno));
-        exit(1);
+    if (statbuf.st_size > 0) {
+        addr = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        /* advice values are not flags, so each is given separately */
+        madvise(addr, statbuf.st_size, MADV_SEQUENTIAL);
+        madvise(addr, statbuf.st_size, MADV_WILLNEED);
     }
-    buf = (char*)malloc(statbuf.st_size);
-    if ((nread = fread(buf, 1, statbuf.st_size, f)) != statbuf.st_size) {
-        printf("load_file: fread: %s: expected %zu got %zu\n",
-            filename, statbuf.st_size, nread);
+    close(fd);
+    *buf = (buffer){addr, (size_t)statbuf.st_size};
+    return 0;
+}
+
+static void unmap_file(buffer *buf)
+{
+    if (buf->data) munmap(buf->data, buf->length);
+    *buf = (buffer){NULL, 0};
+}
+
+static void map_file_or_exit(buffer *buf, const char *filename)
+{
+    if (map_file(buf, filename) < 0) {
+        printf("map_file: %s: %s\n", filename, strerror(errno));
         exit(1);
     }
-    return (buffer){buf, (size_t)statbuf.st_size};
 }
 
 /*
@@ -391,10 +801,19 @@ typedef void (*func_4_3_glGetProgramResourceName)
 (GLuint, GLenum, GLuint, GLsizei, GLsizei *, GLchar *);
 typedef void (*func_4_6_glSpecializeShader)
 (GLuint, const GLchar *, GLuint, const GLuint *, const GLuint *);
+typedef void (*func_4_1_glGetProgramBinary)
+(GLuint, GLsizei, GLsizei *, GLenum *, void *);
+typedef void (*func_4_1_glProgramBinary)
+(GLuint, GLenum, const void *, GLsizei);
+typedef void (*func_4_1_glProgramParameteri)
+(GLuint, GLenum, GLint);
 
 static func_4_1_glShaderBinary           muglShaderBinary;
 static func_4_3_glGetProgramResourceName muglGetProgramResourceName;
 static func_4_6_glSpecializeShader       muglSpecializeShader;
+static func_4_1_glGetProgramBinary       muglGetProgramBinary;
+static func_4_1_glProgramBinary          muglProgramBinary;
+static func_4_1_glProgramParameteri      muglProgramParameteri;
 
 #if defined (OSMESA_MAJOR_VERSION)
 #define muglGetProcAddress OSMesaGetProcAddress
@@ -420,18 +839,76 @@ static void muglInit()
         muglGetProcAddress("glGetProgramResourceName");
     muglSpecializeShader = (func_4_6_glSpecializeShader)
         muglGetProcAddress("glSpecializeShader");
+    muglGetProgramBinary = (func_4_1_glGetProgramBinary)
+        muglGetProcAddress("glGetProgramBinary");
+    muglProgramBinary = (func_4_1_glProgramBinary)
+        muglGetProcAddress("glProgramBinary");
+    muglProgramParameteri = (func_4_1_glProgramParameteri)
+        muglGetProcAddress("glProgramParameteri");
 
     initialized++;
 }
 
-static GLuint compile_shader(GLenum type, const char *filename)
+/*
+ * returns the offset of the line after the #version directive, which must
+ * precede everything but comments and white space, or zero if there is none
+ */
+static size_t shader_version_end(const char *src, size_t length)
+{
+    static const char directive[] = "#version";
+    size_t n = sizeof(directive) - 1;
+
+    for (size_t i = 0; i + n <= length; i++) {
+        if (memcmp(src + i, directive, n) != 0) continue;
+        while (i < length && src[i] != '\n') i++;
+        return i < length ? i + 1 : length;
+    }
+    return 0;
+}
+
+/*
+ * format variant defines followed by a #line directive so that compile
+ * log line numbers refer to the source file
+ */
+static void shader_variant_defines(char *str, size_t size,
+    const shader_variant *variant, const char *src, size_t offset)
+{
+    size_t len = 0;
+    int line = 1;
+
+    for (size_t i = 0; i < offset; i++) {
+        if (src[i] == '\n') line++;
+    }
+    str[0] = 0;
+    for (size_t i = 0; variant && i < variant->num_defines && len < size; i++) {
+        len += snprintf(str + len, size - len, "#define %s %d\n",
+            variant->defines[i].name, variant->defines[i].value);
+    }
+    if (len < size) {
+        snprintf(str + len, size - len, "#line %d\n", line);
+    }
+}
+
+static void shader_specialize(GLuint shader, const shader_variant *variant)
+{
+    GLuint ids[32], values[32], count = 0;
+
+    for (size_t i = 0; variant && i < variant->num_defines && count < 32; i++) {
+        if (variant->defines[i].constant_id < 0) continue;
+        ids[count] = (GLuint)variant->defines[i].constant_id;
+        values[count] = (GLuint)variant->defines[i].value;
+        count++;
+    }
+    muglSpecializeShader(shader, (const GLchar*)"main", count, ids, values);
+}
+
+static GLuint compile_shader_buffer(GLenum type, const char *filename,
+    buffer buf, const shader_variant *variant)
 {
     GLint length, status;
     GLuint shader;
-    buffer buf;
     int is_spirv;
 
-    buf = load_file(filename);
     length = buf.length;
     if (!length) {
         printf("failed to load shader: %s\n", filename);
@@ -444,10 +921,17 @@ static GLuint compile_shader(GLenum type, const char *filename)
         muglInit();
         muglShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V,
             (const void *)buf.data, length);
-        muglSpecializeShader(shader, (const GLchar*)"main", 0, NULL, NULL);
+        shader_specialize(shader, variant);
     } else {
-        glShaderSource(shader, (GLsizei)1,
-            (const GLchar * const *)&buf.data, &length);
+        const char *src = (const char*)buf.data;
+        char defines[1024];
+        size_t offset = shader_version_end(src, buf.length);
+        shader_variant_defines(defines, sizeof(defines), variant, src, offset);
+        const GLchar *strings[3] = { src, defines, src + offset };
+        GLint lengths[3] = {
+            (GLint)offset, (GLint)strlen(defines), (GLint)(buf.length - offset)
+        };
+        glShaderSource(shader, 3, strings, lengths);
         glCompileShader(shader);
     }
 
@@ -468,6 +952,24 @@ static GLuint compile_shader(GLenum type, const char *filename)
     return shader;
 }
 
+static GLuint compile_shader_variant(GLenum type, const char *filename,
+    const shader_variant *variant)
+{
+    GLuint shader;
+    buffer buf;
+
+    map_file_or_exit(&buf, filename);
+    shader = compile_shader_buffer(type, filename, buf, variant);
+    unmap_file(&buf);
+
+    return shader;
+}
+
+static GLuint compile_shader(GLenum type, const char *filename)
+{
+    return compile_shader_variant(type, filename, NULL);
+}
+
 static void reflect_gl2(GLuint program, GLint *numattrs, GLint *numuniforms)
 {
     glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, numattrs);
@@ -510,17 +1012,108 @@ static void reflect_gl4(GLuint program, GLint *numattrs, GLint *numuniforms)
     }
 }
 
+static GLint attr_list_slot(attr_list *list, const char *name)
+{
+    GLuint val = attr_list_value(list, name);
+    return val == ATTR_NOT_FOUND ? -1 : (GLint)val;
+}
+
+/*
+ * resolve attribute and uniform locations into caller provided slot
+ * tables, typically indexed by an enum, so that the draw path can use
+ * the *_slot functions instead of looking up names on every call.
+ * names that are not active in the program resolve to -1.
+ *
+ * uniform blocks are assigned the binding point equal to their index in
+ * the block table, so the layout is fixed by the caller rather than the
+ * driver and buffers can be bound to a block without the program bound.
+ */
+static void resolve_program_slots(GLuint program, program_slots *slots)
+{
+    for (size_t i = 0; i < slots->num_attrs; i++) {
+        slots->attr_slots[i] = attr_list_slot(&attrs, slots->attr_names[i]);
+    }
+    for (size_t i = 0; i < slots->num_uniforms; i++) {
+        slots->uniform_slots[i] = attr_list_slot(&uniforms,
+            slots->uniform_names[i]);
+    }
+    for (size_t i = 0; i < slots->num_blocks; i++) {
+        GLuint idx = glGetUniformBlockIndex(program, slots->block_names[i]);
+        if (idx == GL_INVALID_INDEX) {
+            slots->block_slots[i] = -1;
+        } else {
+            glUniformBlockBinding(program, idx, (GLuint)i);
+            slots->block_slots[i] = (GLint)i;
+        }
+        printf("block %s = %d\n", slots->block_names[i], slots->block_slots[i]);
+    }
+}
+
 static GLuint link_program(const GLuint *shaders, GLuint numshaders,
     GLuint (*bindfn)(GLuint prog))
 {
-    GLuint program, n = 1, relink;
-    GLint status, numattrs, numuniforms;
+    return link_program_slots(shaders, numshaders, bindfn, NULL);
+}
+
+/*
+ * reflect attributes and uniforms of a linked program
+ */
+static void reflect_program(GLuint program)
+{
+    GLint numattrs, numuniforms;
+
+    muglInit();
+    if (muglGetProgramResourceName) {
+        reflect_gl2(program, &numattrs, &numuniforms);
+    } else {
+        reflect_gl4(program, &numattrs, &numuniforms);
+    }
+}
+
+/*
+ * print reflected locations and resolve caller slot tables
+ */
+static void resolve_program(GLuint program, program_slots *slots)
+{
+    /*
+     * Note: support statically linked locations in SPIR-V modules
+     * requires us to accept the locations assigned by the driver,
+     * so after fetching names, instead of explicitly rebinding,
+     * we find the locations assigned by the driver. This is to work
+     * around issues where attempting to re-assign indices fails.
+     */
+    for (size_t i = 0; i < attrs.count; i++) {
+        attrs.arr[i].val = glGetAttribLocation(program, attrs.arr[i].name);
+    }
+
+    for (size_t i = 0; i < attrs.count; i++) {
+        printf("attr %s = %d\n", attrs.arr[i].name, attrs.arr[i].val);
+    }
+    for (size_t i = 0; i < uniforms.count; i++) {
+        printf("uniform %s = %d\n", uniforms.arr[i].name, uniforms.arr[i].val);
+    }
+
+    if (slots) {
+        resolve_program_slots(program, slots);
+    }
+}
+
+static GLuint link_program_create(const GLuint *shaders, GLuint numshaders,
+    GLuint (*bindfn)(GLuint prog), program_slots *slots, int retrievable)
+{
+    GLuint program;
+    GLint status;
 
     program = glCreateProgram();
     for (size_t i = 0; i < numshaders; i++) {
         glAttachShader(program, shaders[i]);
     }
 
+    if (retrievable) {
+        muglProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+            GL_TRUE);
+    }
+
     glLinkProgram(program);
     glGetProgramiv(program, GL_LINK_STATUS, &status);
     if (status == GL_FALSE) {
@@ -528,12 +1121,7 @@ static GLuint link_program(const GLuint *shaders, GLuint numshaders,
         exit(1);
     }
 
-    muglInit();
-    if (muglGetProgramResourceName) {
-        reflect_gl2(program, &numattrs, &numuniforms);
-    } else {
-        reflect_gl4(program, &numattrs, &numuniforms);
-    }
+    reflect_program(program);
 
     /*
      * Note: OpenGL by default binds attributes to locations counting
@@ -559,40 +1147,242 @@ static GLuint link_program(const GLuint *shaders, GLuint numshaders,
         }
     }
 
-    /*
-     * Note: support statically linked locations in SPIR-V modules
-     * requires us to accept the locations assigned by the driver,
-     * so after fetching names, instead of explicitly rebinding,
-     * we find the locations assigned by the driver. This is to work
-     * around issues where attempting to re-assign indices fails.
-     */
-    for (size_t i = 0; i < attrs.count; i++) {
-        attrs.arr[i].val = glGetAttribLocation(program, attrs.arr[i].name);
-    }
-
     for (size_t i = 0; i < numshaders; i++) {
         glDeleteShader(shaders[i]);
     }
 
-    for (size_t i = 0; i < attrs.count; i++) {
-        printf("attr %s = %d\n", attrs.arr[i].name, attrs.arr[i].val);
+    resolve_program(program, slots);
+
+    return program;
+}
+
+static GLuint link_program_slots(const GLuint *shaders, GLuint numshaders,
+    GLuint (*bindfn)(GLuint prog), program_slots *slots)
+{
+    return link_program_create(shaders, numshaders, bindfn, slots, 0);
+}
+
+/*
+ * program binary cache
+ *
+ * linked program binaries are stored in cache_dir under a 64-bit FNV-1a
+ * hash of the shader sources, GLSL or SPIR-V, the variant defines, so each
+ * permutation has its own cache file, and the GL vendor, renderer,
+ * version and shading language version strings, which carry the driver
+ * build on the common drivers. a cache file that does not match the key
+ * or that the driver rejects is a miss, in which case the program is
+ * compiled and linked from source and the cache file is replaced. on a
+ * hit bindfn is not called as attribute bindings are part of the binary.
+ */
+
+static unsigned long long fnv1a_64(unsigned long long h,
+    const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
     }
-    for (size_t i = 0; i < uniforms.count; i++) {
-        printf("uniform %s = %d\n", uniforms.arr[i].name, uniforms.arr[i].val);
+    return h;
+}
+
+static unsigned long long program_cache_key(const shader_source *sources,
+    const buffer *bufs, GLuint numsources, const shader_variant *variant,
+    int rebind)
+{
+    const GLenum strings[] = {
+        GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION
+    };
+    unsigned long long h = 0xcbf29ce484222325ull;
+    GLuint version = PROGRAM_CACHE_VERSION;
+
+    h = fnv1a_64(h, &version, sizeof(version));
+    for (size_t i = 0; i < sizeof(strings)/sizeof(strings[0]); i++) {
+        const char *str = (const char*)glGetString(strings[i]);
+        if (str) h = fnv1a_64(h, str, strlen(str) + 1);
+    }
+    for (size_t i = 0; i < numsources; i++) {
+        h = fnv1a_64(h, &sources[i].type, sizeof(sources[i].type));
+        h = fnv1a_64(h, &bufs[i].length, sizeof(bufs[i].length));
+        h = fnv1a_64(h, bufs[i].data, bufs[i].length);
     }
+    for (size_t i = 0; variant && i < variant->num_defines; i++) {
+        const shader_define *def = &variant->defines[i];
+        h = fnv1a_64(h, def->name, strlen(def->name) + 1);
+        h = fnv1a_64(h, &def->value, sizeof(def->value));
+        h = fnv1a_64(h, &def->constant_id, sizeof(def->constant_id));
+    }
+    return fnv1a_64(h, &rebind, sizeof(rebind));
+}
+
+static int program_cache_supported()
+{
+    GLint formats = 0;
+
+    muglInit();
+    if (!muglGetProgramBinary || !muglProgramBinary || !muglProgramParameteri) {
+        return 0;
+    }
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+static GLuint program_cache_load(const char *path, unsigned long long key)
+{
+    program_cache_header hdr;
+    struct stat statbuf;
+    GLuint program = 0;
+    GLint status;
+    FILE *f;
 
+    if ((f = fopen(path, "rb")) == NULL) return 0;
+    /* the binary length must fit in the file, anything else is a miss */
+    if (fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+        hdr.magic == PROGRAM_CACHE_MAGIC &&
+        hdr.version == PROGRAM_CACHE_VERSION && hdr.key == key &&
+        fstat(fileno(f), &statbuf) == 0 &&
+        hdr.length <= (unsigned long long)statbuf.st_size - sizeof(hdr)) {
+        void *data = malloc(hdr.length);
+        if (data && fread(data, 1, hdr.length, f) == hdr.length) {
+            program = glCreateProgram();
+            muglProgramBinary(program, hdr.format, data, hdr.length);
+            glGetProgramiv(program, GL_LINK_STATUS, &status);
+            if (status == GL_FALSE) {
+                glDeleteProgram(program);
+                program = 0;
+            }
+            /* discard errors from formats the driver no longer accepts */
+            while (glGetError() != GL_NO_ERROR);
+        }
+        free(data);
+    }
+    fclose(f);
     return program;
 }
 
+static void program_cache_mkdir(const char *cache_dir)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s", cache_dir);
+    for (char *p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = 0;
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    mkdir(path, 0755);
+}
+
+static void program_cache_store(const char *cache_dir, const char *path,
+    unsigned long long key, GLuint program)
+{
+    char tmp_path[PATH_MAX];
+    program_cache_header hdr;
+    GLint length = 0;
+    GLenum format;
+    void *data;
+    FILE *f;
+    int ok;
+
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+    data = malloc(length);
+    muglGetProgramBinary(program, length, &length, &format, data);
+
+    hdr.magic = PROGRAM_CACHE_MAGIC;
+    hdr.version = PROGRAM_CACHE_VERSION;
+    hdr.format = format;
+    hdr.length = (GLuint)length;
+    hdr.key = key;
+
+    /* write to a temporary and rename so readers never see partial files */
+    program_cache_mkdir(cache_dir);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d", path, (int)getpid());
+    if ((f = fopen(tmp_path, "wb")) == NULL) {
+        printf("program cache: open: %s: %s\n", tmp_path, strerror(errno));
+        free(data);
+        return;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+         fwrite(data, 1, length, f) == (size_t)length;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmp_path, path) < 0) {
+        printf("program cache: write: %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+    free(data);
+}
+
+/*
+ * compile and link a variant of a program from shader files, using the
+ * program binary cache in cache_dir if it is not NULL and the driver
+ * supports it. variant may be NULL for the sources as written.
+ */
+static GLuint link_program_variant(const shader_source *sources,
+    GLuint numsources, const shader_variant *variant,
+    GLuint (*bindfn)(GLuint prog), program_slots *slots,
+    const char *cache_dir)
+{
+    buffer *bufs = (buffer*)malloc(sizeof(buffer) * numsources);
+    GLuint *shaders = (GLuint*)malloc(sizeof(GLuint) * numsources);
+    int cacheable = cache_dir && cache_dir[0] && program_cache_supported();
+    unsigned long long key = 0;
+    char path[PATH_MAX];
+    GLuint program = 0;
+
+    for (size_t i = 0; i < numsources; i++) {
+        map_file_or_exit(&bufs[i], sources[i].filename);
+    }
+
+    if (cacheable) {
+        key = program_cache_key(sources, bufs, numsources, variant,
+            bindfn != NULL);
+        snprintf(path, sizeof(path), "%s/%016llx.bin", cache_dir, key);
+        program = program_cache_load(path, key);
+    }
+
+    if (program) {
+        printf("program cache hit: %s\n", path);
+        reflect_program(program);
+        resolve_program(program, slots);
+    } else {
+        for (size_t i = 0; i < numsources; i++) {
+            shaders[i] = compile_shader_buffer(sources[i].type,
+                sources[i].filename, bufs[i], variant);
+        }
+        program = link_program_create(shaders, numsources, bindfn, slots,
+            cacheable);
+        if (cacheable) {
+            printf("program cache miss: %s\n", path);
+            program_cache_store(cache_dir, path, key, program);
+        }
+    }
+
+    for (size_t i = 0; i < numsources; i++) {
+        unmap_file(&bufs[i]);
+    }
+    free(shaders);
+    free(bufs);
+
+    return program;
+}
+
+static GLuint link_program_cached(const shader_source *sources,
+    GLuint numsources, GLuint (*bindfn)(GLuint prog), program_slots *slots,
+    const char *cache_dir)
+{
+    return link_program_variant(sources, numsources, NULL, bindfn, slots,
+        cache_dir);
+}
+
 static void buffer_object_create_offset(GLuint *obj, GLenum target,
     array_buffer *ab, size_t offset, size_t count)
 {
     size_t size = array_buffer_stride(ab) * count;
     char *data = (char*)array_buffer_data(ab) + array_buffer_stride(ab) * offset;
     glGenBuffers(1, obj);
-    glBindBuffer(target, *obj);
+    gl_bind_buffer(target, *obj);
     glBufferData(target, size, (void*)data, GL_STATIC_DRAW);
-    glBindBuffer(target, *obj);
 }
 
 static void buffer_object_create(GLuint *obj, GLenum target, array_buffer *ab)
@@ -600,6 +1390,198 @@ static void buffer_object_create(GLuint *obj, GLenum target, array_buffer *ab)
     return buffer_object_create_offset(obj, target, ab, 0, array_buffer_count(ab));
 }
 
+/*
+ * create a static buffer object from a mapped range of a file
+ */
+static void buffer_object_create_mapped(GLuint *obj, GLenum target,
+    buffer *buf, size_t offset, size_t size)
+{
+    glGenBuffers(1, obj);
+    gl_bind_buffer(target, *obj);
+    glBufferData(target, size, (char*)buf->data + offset, GL_STATIC_DRAW);
+}
+
+/*
+ * create a static buffer object from a file, returns -1 on error
+ */
+static int buffer_object_load(GLuint *obj, GLenum target, const char *filename)
+{
+    buffer buf;
+
+    if (map_file(&buf, filename) < 0) return -1;
+    buffer_object_create_mapped(obj, target, &buf, 0, buf.length);
+    unmap_file(&buf);
+    return 0;
+}
+
+/*
+ * streaming buffer
+ *
+ * a buffer object divided into three regions used round robin, one per
+ * frame, for data that changes every frame. with GL_ARB_buffer_storage the
+ * buffer is mapped once persistent and coherent, otherwise each allocation
+ * is mapped with glMapBufferRange unsynchronized and invalidated, which is
+ * safe because a fence placed at the end of each frame is waited on before
+ * its region is written again.
+ *
+ * pointers returned by stream_buffer_alloc are valid until the next alloc
+ * or stream_buffer_flush, which must be called before drawing. NULL is
+ * returned if the allocation does not fit in the region or cannot be
+ * mapped.
+ */
+
+static void stream_buffer_init(stream_buffer *sb, GLenum target,
+    size_t region_size)
+{
+    size_t size = region_size * STREAM_BUFFER_REGIONS;
+
+    memset(sb, 0, sizeof(stream_buffer));
+    sb->target = target;
+    sb->region_size = region_size;
+    sb->region = STREAM_BUFFER_REGIONS - 1;
+    sb->persistent = gl_check_version(4, 4) ||
+        gl_check_extension("GL_ARB_buffer_storage");
+
+    glGenBuffers(1, &sb->obj);
+    gl_bind_buffer(target, sb->obj);
+    if (sb->persistent) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+            GL_MAP_COHERENT_BIT;
+        glBufferStorage(target, size, NULL, flags);
+        sb->map = (char*)glMapBufferRange(target, 0, size, flags);
+    } else {
+        glBufferData(target, size, NULL, GL_STREAM_DRAW);
+    }
+}
+
+static void stream_buffer_destroy(stream_buffer *sb)
+{
+    stream_buffer_flush(sb);
+    for (uint i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+        if (sb->fences[i]) glDeleteSync(sb->fences[i]);
+    }
+    if (sb->map) {
+        gl_bind_buffer(sb->target, sb->obj);
+        glUnmapBuffer(sb->target);
+    }
+    glDeleteBuffers(1, &sb->obj);
+    gl_state_invalidate();
+    memset(sb, 0, sizeof(stream_buffer));
+}
+
+static void stream_buffer_begin_frame(stream_buffer *sb)
+{
+    sb->region = (sb->region + 1) % STREAM_BUFFER_REGIONS;
+    sb->offset = 0;
+
+    GLsync fence = sb->fences[sb->region];
+    if (fence) {
+        glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+        glDeleteSync(fence);
+        sb->fences[sb->region] = 0;
+    }
+}
+
+static void* stream_buffer_alloc(stream_buffer *sb, size_t size,
+    size_t align, size_t *offset)
+{
+    size_t aligned = (sb->offset + align - 1) / align * align;
+    if (aligned + size > sb->region_size) return NULL;
+
+    stream_buffer_flush(sb);
+
+    *offset = sb->region * sb->region_size + aligned;
+    sb->offset = aligned + size;
+
+    if (sb->persistent) {
+        return sb->map + *offset;
+    }
+
+    gl_bind_buffer(sb->target, sb->obj);
+    sb->range = (char*)glMapBufferRange(sb->target, *offset, size,
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+        GL_MAP_INVALIDATE_RANGE_BIT);
+    return sb->range;
+}
+
+static void stream_buffer_flush(stream_buffer *sb)
+{
+    if (sb->range) {
+        gl_bind_buffer(sb->target, sb->obj);
+        glUnmapBuffer(sb->target);
+        sb->range = NULL;
+    }
+}
+
+static void stream_buffer_end_frame(stream_buffer *sb)
+{
+    stream_buffer_flush(sb);
+    if (sb->fences[sb->region]) glDeleteSync(sb->fences[sb->region]);
+    sb->fences[sb->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/*
+ * render target
+ *
+ * an offscreen framebuffer with colour and depth renderbuffers. storage
+ * is only reallocated when the size changes. render_target_blit scales
+ * the colour buffer to the default framebuffer with linear filtering.
+ */
+
+static void render_target_destroy(render_target *rt)
+{
+    if (rt->fbo) glDeleteFramebuffers(1, &rt->fbo);
+    if (rt->color) glDeleteRenderbuffers(1, &rt->color);
+    if (rt->depth) glDeleteRenderbuffers(1, &rt->depth);
+    memset(rt, 0, sizeof(render_target));
+}
+
+static void render_target_resize(render_target *rt, int width, int height)
+{
+    if (rt->fbo && rt->width == width && rt->height == height) return;
+
+    render_target_destroy(rt);
+    glGenFramebuffers(1, &rt->fbo);
+    glGenRenderbuffers(1, &rt->color);
+    glGenRenderbuffers(1, &rt->depth);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, rt->color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, rt->depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, rt->fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_RENDERBUFFER, rt->color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+        GL_RENDERBUFFER, rt->depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("render_target: incomplete framebuffer: 0x%x\n", status);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    rt->width = width;
+    rt->height = height;
+}
+
+static void render_target_bind(render_target *rt)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, rt->fbo);
+    glViewport(0, 0, rt->width, rt->height);
+}
+
+static void render_target_blit(render_target *rt, int width, int height)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, rt->fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, rt->width, rt->height, 0, 0, width, height,
+        GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+}
+
 static void vertex_array_pointer(const char *attr, GLint size,
     GLenum type, GLboolean norm, size_t stride, size_t offset)
 {
@@ -642,3 +1624,67 @@ static void uniform_matrix_4fv(const char *uniform, const GLfloat *mat)
         glUniformMatrix4fv(val, 1, GL_FALSE, mat);
     }
 }
+
+static void vertex_array_pointer_slot(GLint slot, GLint size,
+    GLenum type, GLboolean norm, size_t stride, size_t offset)
+{
+    if (slot >= 0) {
+        glEnableVertexAttribArray(slot);
+        glVertexAttribPointer(slot, size, type, norm, stride, (const void*)offset);
+    }
+}
+
+static void vertex_array_divisor_slot(GLint slot, GLuint divisor)
+{
+    if (slot >= 0) {
+        glVertexAttribDivisor(slot, divisor);
+    }
+}
+
+static void vertex_array_1f_slot(GLint slot, float v1)
+{
+    if (slot >= 0) {
+        glDisableVertexAttribArray(slot);
+        glVertexAttrib1f(slot, v1);
+    }
+}
+
+static void uniform_1i_slot(GLint slot, GLint i)
+{
+    if (slot >= 0) {
+        glUniform1i(slot, i);
+    }
+}
+
+static void uniform_3f_slot(GLint slot, GLfloat v1, GLfloat v2, GLfloat v3)
+{
+    if (slot >= 0) {
+        glUniform3f(slot, v1, v2, v3);
+    }
+}
+
+static void uniform_matrix_4fv_slot(GLint slot, const GLfloat *mat)
+{
+    if (slot >= 0) {
+        glUniformMatrix4fv(slot, 1, GL_FALSE, mat);
+    }
+}
+
+/*
+ * bind a range of a buffer to the binding point of a uniform block slot.
+ * offset must be a multiple of uniform_buffer_alignment.
+ */
+static void uniform_block_range_slot(GLint slot, GLuint buffer,
+    size_t offset, size_t size)
+{
+    if (slot >= 0) {
+        glBindBufferRange(GL_UNIFORM_BUFFER, slot, buffer, offset, size);
+    }
+}
+
+static size_t uniform_buffer_alignment()
+{
+    GLint align = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+    return align > 0 ? (size_t)align : 256;
+}
@@ -25,10 +25,19 @@
 #include <time.h>
 #include <signal.h>
 #include <libgen.h>
+#include <limits.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
 
 #define __USE_GNU
-#include <sys/poll.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
@@ -42,6 +51,14 @@
 
 #include "linmath.h"
 #include "gl2_util.h"
+#include "spsc_queue.h"
+#include "job_system.h"
+#include "timing_stats.h"
+#include "frame_trace.h"
+#include "mesh_file.h"
+#include "mesh_optimize.h"
+#include "x11_present.h"
+#include "frame_metrics.h"
 
 typedef unsigned long ulong;
 
@@ -50,8 +67,15 @@ typedef unsigned long ulong;
 #define Debug(...) { if (debug) fprintf(stdout, __VA_ARGS__); }
 #define Trace(...) { if (trace) fprintf(stdout, __VA_ARGS__); }
 #define Panic(...) { fprintf(stderr, __VA_ARGS__); exit(9); }
+#define TraceRecord(time, window, type, flags, a0, a1, a2) { \
+    if (trace_file.header) frame_trace_add(&trace_file, time, frame_number, \
+        window, type, flags, a0, a1, a2); }
 
 static int help, debug, trace;
+static const char *trace_filename;
+static frame_trace trace_file;
+static const char *metrics_filename;
+static frame_metrics metrics_file;
 
 /*
  * extended frame synchronization
@@ -66,19 +90,6 @@ static Atom _NET_WM_FRAME_DRAWN;
 static Atom _NET_WM_FRAME_TIMINGS;
 static Atom _NET_WM_PING;
 
-static int request_extended_sync;
-static int configure_extended_sync;
-
-static ulong current_sync_serial;
-static ulong request_sync_serial;
-static ulong configure_sync_serial;
-static ulong inflight_sync_serial;
-static ulong drawn_sync_serial;
-static ulong timing_sync_serial;
-
-static XSyncCounter update_counter;
-static XSyncCounter extended_counter;
-
 static Atom *supported_atoms;
 static long num_supported_atoms;
 static int xsync_event_base;
@@ -89,79 +100,777 @@ static int have_net_supported;
 static int have_wm_moveresize;
 static int use_frame_sync = 1;
 
+/*
+ * vblank phase-locked frame scheduling
+ */
+
+typedef enum { schedule_clock, schedule_vblank } schedule_mode;
+
+static schedule_mode scheduler = schedule_clock;
+static long vblank_lead = 4000;
+
+/*
+ * Present extension frame timings
+ *
+ * without a compositor there are no _NET_WM_FRAME_DRAWN and
+ * _NET_WM_FRAME_TIMINGS messages, but on DRI3 the driver performs swaps
+ * with PresentPixmap and the server reports a CompleteNotify with the
+ * UST and MSC of the vblank at which each swap completed. the driver's
+ * present serials are not visible to us, so completions are matched to
+ * our sync serials in submission order, which the server preserves.
+ * if no pixmap completions arrive, a NotifyMSC is requested after each
+ * swap so that the vblank phase and period are still known.
+ */
+
+typedef enum { timing_ewmh, timing_present } timing_source_mode;
+
+enum { PRESENT_PENDING_FRAMES = 16 };
+
+static timing_source_mode timing_source = timing_ewmh;
+static x11_present present;
+static int have_present_extension;
+
+/*
+ * pipelined frames in flight
+ */
+
+typedef struct {
+    ulong sync_serial;
+    long submit_time;
+    long input_time;
+    GLsync fence;
+} inflight_frame;
+
+enum { MAX_INFLIGHT_FRAMES = 8 };
+
+static uint max_inflight = 1;
+
 /*
  * glcube demo
  */
 
+typedef struct {
+    mat4x4 m;
+    vec4f col;
+} instance;
+
+/* std140 layout of frame_block and object_block in cube.vsh */
+typedef struct {
+    mat4x4 projection;
+    mat4x4 view;
+    vec4f lightpos;
+} frame_uniforms;
+
+typedef struct {
+    mat4x4 model;
+} object_uniforms;
+
 typedef struct model_object {
+    GLuint vao;
     GLuint vbo;
     GLuint ibo;
+    stream_buffer instance_stream;
     vertex_buffer vb;
     index_buffer ib;
-    mat4x4 m, v;
+    uint index_count;
+    GLenum index_type;
+    uint instance_count;
+    instance *instance_map;
+    size_t instance_offset;
+    float instance_time;
+    size_t uniform_offset;
+    mat4x4 m;
 } model_object_t;
 
+typedef enum {
+    attr_pos,
+    attr_normal,
+    attr_uv,
+    attr_color,
+    attr_model,
+    attr_instance_color,
+    attr_slot_count
+} attr_slot;
+
+typedef enum {
+    block_frame,
+    block_object,
+    block_slot_count
+} block_slot;
+
+static const char* attr_slot_names[] = {
+    [attr_pos] = "a_pos",
+    [attr_normal] = "a_normal",
+    [attr_uv] = "a_uv",
+    [attr_color] = "a_color",
+    [attr_model] = "a_model",
+    [attr_instance_color] = "a_instance_color",
+};
+
+static const char* block_slot_names[] = {
+    [block_frame] = "frame_block",
+    [block_object] = "object_block",
+};
+
+static GLint attr_slots[attr_slot_count];
+static GLint block_slots[block_slot_count];
+
+static program_slots cube_slots = {
+    attr_slot_names, attr_slots, attr_slot_count,
+    NULL, NULL, 0,
+    block_slot_names, block_slots, block_slot_count
+};
+
 static const char* frag_shader_filename = "shaders/cube.fsh";
 static const char* vert_shader_filename = "shaders/cube.vsh";
+static const char* mesh_filename;
+static int optimize_mesh;
+static int use_scene_arena;
+static arena scene_arena;
+
+enum { SCENE_ARENA_BLOCK_SIZE = 1 << 20 };
+static int optimize_overdraw;
+static const char* shader_cache_dir;
+static int use_shader_cache = 1;
+static char shader_cache_path[PATH_MAX];
+
+/*
+ * fragment shader variant
+ *
+ * the variant is built from --define and --noise options and every
+ * permutation has its own program cache entry. defines that are listed in
+ * shader_constants are also passed to SPIR-V modules as specialization
+ * constants with the given constant_id.
+ */
+enum { MAX_SHADER_DEFINES = 16 };
+typedef enum { noise_off, noise_hash, noise_lut } noise_mode;
+
+static const char* noise_mode_names[] = {
+    [noise_off] = "off",
+    [noise_hash] = "hash",
+    [noise_lut] = "lut",
+};
+
+static const struct { const char *name; int constant_id; } shader_constants[] = {
+    { "NROUNDS", 0 },
+    { "LIGHTING", 1 },
+    { "NOISE", 2 },
+};
+
+static shader_define shader_defines[MAX_SHADER_DEFINES];
+static uint num_shader_defines;
 
-static float t = 0.f;
 static bool animation = 1;
 static GLuint program;
-static mat4x4 v, p;
+static mat4x4 v;
 static model_object_t mo[1];
+static stream_buffer uniform_stream;
+static size_t uniform_align;
+static uint num_instances = 1;
+static int num_job_threads = -1;
+static job_system jobs;
+
+enum { INSTANCE_JOB_GRAIN = 256 };
 static float frame_rate = 29.97;
-static ulong frame_number;
-static long last_draw_time;
-static long next_draw_time;
+static _Atomic ulong frame_number;
 static long current_time;
-static long delta_time;
-static long render_time;
 static int width = 500, height = 500;
-static int current_width, current_height;
+
+/*
+ * dynamic resolution
+ *
+ * when the smoothed GPU time of recent frames, or the render time if
+ * there are no GPU timers, exceeds the frame budget, frames are drawn
+ * into an offscreen render target at a reduced scale and scaled up to
+ * the window with a linear blit. the scale follows a hysteresis
+ * controller: it drops a step after the cost has been above the high
+ * threshold for several frames, and only rises after the cost predicted
+ * at the next step up has stayed below the low threshold for longer.
+ * after each change, and after resizes, the controller waits for the
+ * statistics to settle at the new scale.
+ */
+
+enum {
+    DYNRES_TRIGGER_FRAMES = 4,
+    DYNRES_RECOVER_FRAMES = 32,
+    DYNRES_SETTLE_FRAMES = 16
+};
+
+static const float dynres_min_scale = 0.5f;
+static const float dynres_step = 0.05f;
+static const float dynres_high = 0.9f;
+static const float dynres_low = 0.75f;
+
+static int use_dynamic_resolution;
+
+/*
+ * GPU timer queries
+ *
+ * GL_TIMESTAMP queries are issued at frame start, after the clear, after
+ * draw_frame and after the swap. query sets are kept in a ring of three
+ * frames and results are only read once available, so the CPU never waits
+ * for the GPU. if the ring is full the frame is not timed.
+ */
+
+enum { GPU_TIMER_FRAMES = 3 };
+
+typedef enum {
+    gpu_mark_begin,
+    gpu_mark_clear,
+    gpu_mark_draw,
+    gpu_mark_swap,
+    gpu_mark_count
+} gpu_timer_mark_point;
+
+static int have_gpu_timer;
+
+/*
+ * render messages
+ *
+ * events that affect rendering are decoded by process_event into messages
+ * that are handled by the render side. in single threaded mode messages are
+ * handled immediately, and with a render thread they are passed through a
+ * lock-free single producer single consumer queue.
+ *
+ * state ownership with a render thread:
+ *
+ * - event thread: Display connection used for events, answering pings,
+ *   and in each window request_sync_serial, request_extended_sync and the
+ *   coalescing state. sync requests are forwarded with the ConfigureNotify
+ *   that consumes them.
+ * - render thread: Display connection used for GLX and counter updates,
+ *   the GL context, and all other window state: width and height, the
+ *   extended and basic counters, sync serials other than the request
+ *   serials, frame timings, the inflight ring, the schedule and the frame
+ *   statistics.
+ * - shared: the queue and its eventfd, read-only options, the window ids,
+ *   frame_number which is atomic so that it can be used in trace messages.
+ *
+ * messages carry the index of the window they are for.
+ */
+
+typedef enum {
+    msg_configure,
+    msg_expose,
+    msg_frame_drawn,
+    msg_frame_timings,
+    msg_present_complete,
+    msg_present_idle,
+    msg_input,
+    msg_visibility,
+    msg_map,
+    msg_focus,
+} render_msg_type;
 
 typedef struct {
-    long sum;
-    long count;
-    long offset;
-    long samples[31];
-} circular_buffer;
+    render_msg_type type;
+    uint window;
+    union {
+        struct { int width, height, extended_sync; ulong sync_serial; } configure;
+        struct { ulong sync_serial; long drawn_time; } drawn;
+        struct {
+            ulong sync_serial;
+            int presentation_offset, refresh_interval, frame_delay;
+        } timings;
+        struct { uint64_t ust, msc; int kind, mode; } present;
+        struct { long input_time; } input;
+        struct { int value; } state;
+    };
+} render_msg;
+
+/*
+ * per-window state
+ *
+ * each window has its own sync counters and serials, inflight ring,
+ * frame schedule, statistics, dynamic resolution and GPU timers, so that
+ * windows are paced independently from their own frame timings. the GL
+ * context, program and scene objects are shared by all windows.
+ */
 
-static circular_buffer frame_time_buffer;
-static circular_buffer render_time_buffer;
+enum { MAX_WINDOWS = 16 };
+
+typedef struct {
+    Window w;
+    uint index;
+
+    /* sync requests and coalescing, owned by the event thread */
+    int request_extended_sync;
+    ulong request_sync_serial;
+    int pending_configure;
+    int pending_expose;
+    int pending_input;
+    long pending_input_time;
+    render_msg pending_configure_msg;
+    ulong coalesced_configures;
+    ulong coalesced_exposes;
+
+    /* extended frame synchronization */
+    XSyncCounter update_counter;
+    XSyncCounter extended_counter;
+    int configure_extended_sync;
+    ulong current_sync_serial;
+    ulong configure_sync_serial;
+    ulong inflight_sync_serial;
+    ulong drawn_sync_serial;
+    ulong timing_sync_serial;
+
+    /* vblank phase and period */
+    long vblank_time;
+    long vblank_interval;
+    ulong frame_drawn_serial;
+    long frame_drawn_time;
+
+    /* Present completions */
+    XID present_eid;
+    int have_present_pixmap;
+    ulong present_pending[PRESENT_PENDING_FRAMES];
+    uint present_pending_head, present_pending_tail;
+    uint64_t present_last_ust, present_last_msc;
+    ulong present_complete_count, present_idle_count;
+
+    /* frames in flight */
+    inflight_frame inflight_ring[MAX_INFLIGHT_FRAMES];
+    uint inflight_head;
+    uint inflight_tail;
+
+    /* frame schedule and statistics */
+    long last_draw_time;
+    long next_draw_time;
+    long delta_time;
+    long render_time;
+    int frame_deferred;
+    long frame_deferred_time;
+    int frame_idle;
+    int obscured, unmapped, unfocused;
+    int width, height;
+    int current_width, current_height;
+    float t;
+    mat4x4 p;
+    timing_series frame_time_buffer;
+    timing_series render_time_buffer;
+    timing_series compositor_latency_buffer;
+    timing_series gpu_time_buffer;
+
+    /* input events not yet consumed by a frame and their latency */
+    long input_time;
+    timing_series input_latency_buffer;
+
+    /* dynamic resolution */
+    float render_scale;
+    uint dynres_over, dynres_under, dynres_settle;
+    render_target scene_target;
+
+    /* refresh rate divisor */
+    uint rate_divisor, rate_over, rate_under, rate_settle;
+
+    /* GPU timer queries */
+    int gpu_timer_active;
+    GLuint gpu_queries[GPU_TIMER_FRAMES][gpu_mark_count];
+    uint gpu_query_head;
+    uint gpu_query_tail;
+    long gpu_clear_time;
+    long gpu_draw_time;
+    long gpu_swap_time;
+} app_window;
+
+static app_window windows[MAX_WINDOWS];
+static uint num_windows = 1;
+
+static app_window* window_find(Window w)
+{
+    for (uint i = 0; i < num_windows; i++) {
+        if (windows[i].w == w) return &windows[i];
+    }
+    return NULL;
+}
 
-static void circular_buffer_add(circular_buffer *buffer, long new_value)
+/*
+ * returns the window with the earliest frame deadline, or NULL if every
+ * window is idle
+ */
+static app_window* window_next()
 {
-    long old_value = buffer->samples[buffer->offset];
-    buffer->samples[buffer->offset] = new_value;
-    buffer->sum += new_value - old_value;
-    buffer->count++;
-    buffer->offset++;
-    if (buffer->offset >= array_size(buffer->samples)) {
-        buffer->offset = 0;
+    app_window *next = NULL;
+    for (uint i = 0; i < num_windows; i++) {
+        if (windows[i].frame_idle) continue;
+        if (!next || windows[i].next_draw_time < next->next_draw_time) {
+            next = &windows[i];
+        }
     }
+    return next;
+}
+
+/*
+ * refresh rate divisor
+ *
+ * with --auto-rate the target frame rate is an exact divisor of the
+ * refresh rate from frame timings, so every frame is shown for the same
+ * number of refresh intervals. the divisor follows a hysteresis controller
+ * on the 95th percentile of recent render and GPU times: it drops to the
+ * lowest rate that fits once the cost has been above the high threshold
+ * of the frame budget for several frames, and only rises a step after the
+ * cost has stayed below the low threshold of the budget at the next rate
+ * up for much longer. --frame-rate is the highest rate that is chosen.
+ */
+enum {
+    RATE_MAX_DIVISOR = 4,
+    RATE_TRIGGER_FRAMES = 8,
+    RATE_RECOVER_FRAMES = 120,
+    RATE_SETTLE_FRAMES = 32
+};
+
+static const float rate_high = 0.95f;
+static const float rate_low = 0.7f;
+
+static int use_auto_rate;
+
+static float window_auto_rate(app_window *win)
+{
+    if (!use_auto_rate || win->rate_divisor == 0) return frame_rate;
+    return 1e6f / (float)(win->vblank_interval * win->rate_divisor);
+}
+
+/*
+ * the smallest divisor whose rate is at most --frame-rate, with a little
+ * slack so that 59.94 selects every refresh of a 60Hz display
+ */
+static uint rate_min_divisor(app_window *win)
+{
+    long interval = win->vblank_interval;
+    long period = (long)(1e6f / frame_rate) - interval / 16;
+    long divisor = (period + interval - 1) / interval;
+    if (divisor < 1) divisor = 1;
+    if (divisor > RATE_MAX_DIVISOR) divisor = RATE_MAX_DIVISOR;
+    return (uint)divisor;
+}
+
+static void rate_set_divisor(app_window *win, uint divisor, long cost)
+{
+    Debug("[%lu/%ld] AutoRate: window=%u divisor=%u->%u rate=%.2f "
+        "cost=%ld refresh_interval=%ld\n", frame_number, current_time,
+        win->index, win->rate_divisor, divisor,
+        1e6f / (float)(win->vblank_interval * divisor), cost,
+        win->vblank_interval);
+    win->rate_divisor = divisor;
+    win->rate_over = win->rate_under = 0;
+    win->rate_settle = RATE_SETTLE_FRAMES;
 }
 
-static long circular_buffer_average(circular_buffer *buffer)
+static void rate_update(app_window *win)
 {
-    if (buffer->count == 0) {
-        return -1;
-    } else if (buffer->count < array_size(buffer->samples)) {
-        return buffer->sum / buffer->count;
+    if (!use_auto_rate || win->vblank_interval == 0) return;
+
+    /* start at the highest rate once the refresh interval is known */
+    uint min_divisor = rate_min_divisor(win);
+    if (win->rate_divisor < min_divisor) {
+        rate_set_divisor(win, min_divisor, 0);
+        return;
+    }
+    if (win->rate_settle > 0) {
+        win->rate_settle--;
+        return;
+    }
+
+    long cost = timing_series_percentile(&win->render_time_buffer, 95);
+    long gpu_cost = timing_series_percentile(&win->gpu_time_buffer, 95);
+    if (gpu_cost > cost) cost = gpu_cost;
+    if (cost <= 0) return;
+
+    long interval = win->vblank_interval;
+    uint divisor = win->rate_divisor;
+
+    if (cost > interval * divisor * rate_high) {
+        win->rate_under = 0;
+        if (++win->rate_over >= RATE_TRIGGER_FRAMES &&
+            divisor < RATE_MAX_DIVISOR) {
+            while (divisor < RATE_MAX_DIVISOR &&
+                   cost > interval * divisor * rate_high) {
+                divisor++;
+            }
+            rate_set_divisor(win, divisor, cost);
+        }
+    } else if (divisor > min_divisor &&
+               cost < interval * (divisor - 1) * rate_low) {
+        win->rate_over = 0;
+        if (++win->rate_under >= RATE_RECOVER_FRAMES) {
+            rate_set_divisor(win, divisor - 1, cost);
+        }
     } else {
-        return buffer->sum / array_size(buffer->samples);
+        win->rate_over = win->rate_under = 0;
+    }
+}
+
+/*
+ * idle policy
+ *
+ * paced frames stop while a window is unmapped or fully obscured, or if
+ * the scene is static, and unfocused windows are paced at a fraction of
+ * the frame rate. an idle window is drawn for expose, configure and sync
+ * requests and input, through the normal frame path so that its counters
+ * advance as for any other frame, and then returns to idle.
+ */
+enum { IDLE_UNFOCUSED_DIVISOR = 4 };
+
+static int use_idle_policy = 1;
+
+static int window_idle(app_window *win)
+{
+    return use_idle_policy && (win->unmapped || win->obscured || !animation);
+}
+
+static float window_frame_rate(app_window *win, float target_frame_rate)
+{
+    if (use_auto_rate) {
+        target_frame_rate = window_auto_rate(win);
+    }
+    return use_idle_policy && win->unfocused ?
+        target_frame_rate / IDLE_UNFOCUSED_DIVISOR : target_frame_rate;
+}
+
+static void window_wake(app_window *win)
+{
+    if (!win->frame_idle) return;
+    win->frame_idle = 0;
+    win->next_draw_time = current_time;
+}
+
+static void gpu_timer_init()
+{
+    have_gpu_timer = gl_check_version(3, 3) ||
+        gl_check_extension("GL_ARB_timer_query");
+
+    for (uint i = 0; have_gpu_timer && i < num_windows; i++) {
+        glGenQueries(GPU_TIMER_FRAMES * gpu_mark_count,
+            &windows[i].gpu_queries[0][0]);
+    }
+}
+
+static void gpu_timer_mark(app_window *win, gpu_timer_mark_point point)
+{
+    if (!win->gpu_timer_active) return;
+    glQueryCounter(
+        win->gpu_queries[win->gpu_query_head % GPU_TIMER_FRAMES][point],
+        GL_TIMESTAMP);
+}
+
+static void gpu_timer_begin_frame(app_window *win)
+{
+    win->gpu_timer_active = have_gpu_timer &&
+        win->gpu_query_head - win->gpu_query_tail < GPU_TIMER_FRAMES;
+    gpu_timer_mark(win, gpu_mark_begin);
+}
+
+static void gpu_timer_end_frame(app_window *win)
+{
+    gpu_timer_mark(win, gpu_mark_swap);
+    if (win->gpu_timer_active) win->gpu_query_head++;
+    win->gpu_timer_active = 0;
+}
+
+static void gpu_timer_collect(app_window *win)
+{
+    while (win->gpu_query_tail != win->gpu_query_head) {
+        GLuint *q = win->gpu_queries[win->gpu_query_tail % GPU_TIMER_FRAMES];
+        GLuint64 t[gpu_mark_count];
+        GLint available = 0;
+
+        glGetQueryObjectiv(q[gpu_mark_swap], GL_QUERY_RESULT_AVAILABLE,
+            &available);
+        if (!available) break;
+
+        for (int i = 0; i < gpu_mark_count; i++) {
+            glGetQueryObjectui64v(q[i], GL_QUERY_RESULT, &t[i]);
+        }
+        win->gpu_clear_time =
+            (long)((t[gpu_mark_clear] - t[gpu_mark_begin]) / 1000);
+        win->gpu_draw_time =
+            (long)((t[gpu_mark_draw] - t[gpu_mark_clear]) / 1000);
+        win->gpu_swap_time =
+            (long)((t[gpu_mark_swap] - t[gpu_mark_draw]) / 1000);
+        timing_series_add(&win->gpu_time_buffer,
+            (long)((t[gpu_mark_swap] - t[gpu_mark_begin]) / 1000));
+        win->gpu_query_tail++;
+    }
+}
+
+/*
+ * CPU side geometry is built in the arena if not NULL, and is released
+ * once the object is frozen or loaded.
+ */
+static void model_object_init(model_object_t *mo, uint instance_count,
+    arena *a)
+{
+    vertex_buffer_init_arena(&mo->vb, a);
+    index_buffer_init_arena(&mo->ib, a);
+    mo->instance_count = instance_count;
+    mat4x4_identity(mo->m);
+}
+
+/*
+ * point per-instance model matrix columns and colour at the streamed
+ * instance data for this frame. the vertex array must be bound.
+ */
+static void model_object_instance_pointers(model_object_t *mo, size_t offset)
+{
+    gl_bind_buffer(GL_ARRAY_BUFFER, mo->instance_stream.obj);
+    for (int i = 0; i < 4; i++) {
+        GLint slot = attr_slots[attr_model] < 0 ? -1 : attr_slots[attr_model] + i;
+        vertex_array_pointer_slot(slot, 4, GL_FLOAT, 0, sizeof(instance),
+            offset + offsetof(instance,m) + sizeof(vec4) * i);
+        vertex_array_divisor_slot(slot, 1);
     }
+    vertex_array_pointer_slot(attr_slots[attr_instance_color], 4, GL_FLOAT, 0,
+        sizeof(instance), offset + offsetof(instance,col));
+    vertex_array_divisor_slot(attr_slots[attr_instance_color], 1);
 }
 
-static void model_object_init(model_object_t *mo)
+/*
+ * set up the per-instance stream and finish the vertex array object
+ */
+static void model_object_instance_init(model_object_t *mo)
 {
-    vertex_buffer_init(&mo->vb);
-    index_buffer_init(&mo->ib);
+    /* per-instance data is streamed each frame */
+    stream_buffer_init(&mo->instance_stream, GL_ARRAY_BUFFER,
+        mo->instance_count * sizeof(instance));
+    model_object_instance_pointers(mo, 0);
+    gl_bind_vertex_array(0);
 }
 
+/*
+ * upload buffers and record the vertex layout in a vertex array object.
+ * attribute slots must be resolved before the object is frozen.
+ */
 static void model_object_freeze(model_object_t *mo)
 {
+    glGenVertexArrays(1, &mo->vao);
+    gl_bind_vertex_array(mo->vao);
     buffer_object_create(&mo->vbo, GL_ARRAY_BUFFER, &mo->vb);
     buffer_object_create(&mo->ibo, GL_ELEMENT_ARRAY_BUFFER, &mo->ib);
+    vertex_array_pointer_slot(attr_slots[attr_pos], 3, GL_FLOAT, 0, sizeof(vertex), offsetof(vertex,pos));
+    vertex_array_pointer_slot(attr_slots[attr_normal], 3, GL_FLOAT, 0, sizeof(vertex), offsetof(vertex,norm));
+    vertex_array_pointer_slot(attr_slots[attr_uv], 2, GL_FLOAT, 0, sizeof(vertex), offsetof(vertex,uv));
+    vertex_array_pointer_slot(attr_slots[attr_color], 4, GL_FLOAT, 0, sizeof(vertex), offsetof(vertex,col));
+    mo->index_count = index_buffer_count(&mo->ib);
+    mo->index_type = GL_UNSIGNED_INT;
+    vertex_buffer_destroy(&mo->vb);
+    index_buffer_destroy(&mo->ib);
+    model_object_instance_init(mo);
+}
+
+/*
+ * weld, reorder for the vertex cache, optionally for overdraw, and reorder
+ * for vertex fetch, before the buffers are frozen.
+ */
+static void model_object_optimize(model_object_t *mo)
+{
+    uint32_t *indices = (uint32_t*)index_buffer_data(&mo->ib);
+    size_t index_count = index_buffer_count(&mo->ib);
+    uint32_t vertex_count = vertex_buffer_count(&mo->vb);
+    uint32_t initial_count = vertex_count;
+    float acmr = mesh_acmr(indices, index_count, vertex_count, MESH_FIFO_SIZE);
+
+    vertex_count = mesh_weld_vertices(indices, index_count,
+        vertex_buffer_data(&mo->vb), vertex_count, sizeof(vertex));
+    mesh_optimize_vertex_cache(indices, index_count, vertex_count);
+    if (optimize_overdraw) {
+        mesh_optimize_overdraw(indices, index_count,
+            vertex_buffer_data(&mo->vb), vertex_count, sizeof(vertex), 1.05f);
+    }
+    vertex_count = mesh_optimize_vertex_fetch(indices, index_count,
+        vertex_buffer_data(&mo->vb), vertex_count, sizeof(vertex));
+    mo->vb.count = vertex_count;
+
+    printf("mesh: vertices %u -> %u, acmr %.3f -> %.3f\n",
+        initial_count, vertex_count, acmr,
+        mesh_acmr(indices, index_count, vertex_count, MESH_FIFO_SIZE));
+}
+
+/*
+ * GL vertex formats and shader attribute slots for mesh file attributes
+ */
+
+typedef struct {
+    GLint size;
+    GLenum type;
+    GLboolean norm;
+} mesh_gl_format;
+
+static const mesh_gl_format mesh_gl_formats[] = {
+    [mesh_format_float2] = { 2, GL_FLOAT, GL_FALSE },
+    [mesh_format_float3] = { 3, GL_FLOAT, GL_FALSE },
+    [mesh_format_float4] = { 4, GL_FLOAT, GL_FALSE },
+    [mesh_format_half2] = { 2, GL_HALF_FLOAT, GL_FALSE },
+    [mesh_format_snorm10x3] = { 4, GL_INT_2_10_10_10_REV, GL_TRUE },
+    [mesh_format_unorm8x4] = { 4, GL_UNSIGNED_BYTE, GL_TRUE },
+};
+
+static const attr_slot mesh_attr_slots[] = {
+    [mesh_attr_pos] = attr_pos,
+    [mesh_attr_normal] = attr_normal,
+    [mesh_attr_uv] = attr_uv,
+    [mesh_attr_color] = attr_color,
+};
+
+/*
+ * load a binary mesh file into a model object. the vertex and index ranges
+ * of the mapping are uploaded directly and the file is unmapped. the object
+ * transform scales the mesh bounds to the size of the procedural cube.
+ */
+static void model_object_load(model_object_t *mo, const char *filename)
+{
+    const mesh_file_header *hdr;
+    const mesh_file_attr *attrs;
+    buffer buf;
+    bool present[mesh_attr_count] = { 0 };
+
+    if (map_file(&buf, filename) < 0) {
+        Panic("Cannot open mesh: %s: %s\n", filename, strerror(errno));
+    }
+    if ((hdr = mesh_file_validate(buf.data, buf.length)) == NULL) {
+        Panic("Invalid mesh file: %s\n", filename);
+    }
+    attrs = mesh_file_attrs(hdr);
+
+    glGenVertexArrays(1, &mo->vao);
+    gl_bind_vertex_array(mo->vao);
+    buffer_object_create_mapped(&mo->vbo, GL_ARRAY_BUFFER, &buf,
+        hdr->vertex_offset, (size_t)hdr->vertex_count * hdr->vertex_stride);
+    buffer_object_create_mapped(&mo->ibo, GL_ELEMENT_ARRAY_BUFFER, &buf,
+        hdr->index_offset, hdr->index_count * mesh_index_size(hdr->index_type));
+    for (uint i = 0; i < hdr->attr_count; i++) {
+        const mesh_gl_format *fmt = &mesh_gl_formats[attrs[i].format];
+        present[attrs[i].semantic] = 1;
+        vertex_array_pointer_slot(attr_slots[mesh_attr_slots[attrs[i].semantic]],
+            fmt->size, fmt->type, fmt->norm, hdr->vertex_stride, attrs[i].offset);
+    }
+    if (!present[mesh_attr_color] && attr_slots[attr_color] >= 0) {
+        glDisableVertexAttribArray(attr_slots[attr_color]);
+        glVertexAttrib4f(attr_slots[attr_color], 1.f, 1.f, 1.f, 1.f);
+    }
+    mo->index_count = hdr->index_count;
+    mo->index_type = hdr->index_type == mesh_index_u16 ?
+        GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+    float extent = 0.f;
+    vec3 center;
+    for (int i = 0; i < 3; i++) {
+        float e = hdr->bounds_max[i] - hdr->bounds_min[i];
+        if (e > extent) extent = e;
+        center[i] = 0.5f * (hdr->bounds_min[i] + hdr->bounds_max[i]);
+    }
+    float scale = extent > 0.f ? 6.f / extent : 1.f;
+    mat4x4_identity(mo->m);
+    mat4x4_scale_aniso(mo->m, mo->m, scale, scale, scale);
+    mat4x4_translate_in_place(mo->m, -center[0], -center[1], -center[2]);
+
+    Debug("mesh: %s vertices=%u indices=%u stride=%u index_size=%zu\n",
+        filename, hdr->vertex_count, hdr->index_count, hdr->vertex_stride,
+        mesh_index_size(hdr->index_type));
+
+    unmap_file(&buf);
+    vertex_buffer_destroy(&mo->vb);
+    index_buffer_destroy(&mo->ib);
+    model_object_instance_init(mo);
 }
 
 static void model_object_cube(model_object_t *mo, float s, vec4f col)
@@ -194,23 +903,25 @@ static void model_object_cube(model_object_t *mo, float s, vec4f col)
     };
 
     uint idx = vertex_buffer_count(&mo->vb);
+    vertex_buffer_reserve(&mo->vb, idx + 24);
+    index_buffer_reserve(&mo->ib, index_buffer_count(&mo->ib) + 36);
     for (int i = 0; i < 6; i++) {
+        vertex v[4];
         for (int j = 0; j < 4; j++) {
-            vertex v;
-            v.pos.x = f[i][0][0]*t[j].pos.x + f[i][0][1]*t[j].pos.y + f[i][0][2]*t[j].pos.z;
-            v.pos.y = f[i][1][0]*t[j].pos.x + f[i][1][1]*t[j].pos.y + f[i][1][2]*t[j].pos.z;
-            v.pos.z = f[i][2][0]*t[j].pos.x + f[i][2][1]*t[j].pos.y + f[i][2][2]*t[j].pos.z;
-            v.norm.x = f[i][0][0]*t[j].norm.x + f[i][0][1]*t[j].norm.y + f[i][0][2]*t[j].norm.z;
-            v.norm.y = f[i][1][0]*t[j].norm.x + f[i][1][1]*t[j].norm.y + f[i][1][2]*t[j].norm.z;
-            v.norm.z = f[i][2][0]*t[j].norm.x + f[i][2][1]*t[j].norm.y + f[i][2][2]*t[j].norm.z;
-            v.uv.x = t[j].uv.x;
-            v.uv.y = t[j].uv.y;
-            v.col.r = colors[i][0];
-            v.col.g = colors[i][1];
-            v.col.b = colors[i][2];
-            v.col.a = colors[i][3];
-            vertex_buffer_add(&mo->vb, v);
+            v[j].pos.x = f[i][0][0]*t[j].pos.x + f[i][0][1]*t[j].pos.y + f[i][0][2]*t[j].pos.z;
+            v[j].pos.y = f[i][1][0]*t[j].pos.x + f[i][1][1]*t[j].pos.y + f[i][1][2]*t[j].pos.z;
+            v[j].pos.z = f[i][2][0]*t[j].pos.x + f[i][2][1]*t[j].pos.y + f[i][2][2]*t[j].pos.z;
+            v[j].norm.x = f[i][0][0]*t[j].norm.x + f[i][0][1]*t[j].norm.y + f[i][0][2]*t[j].norm.z;
+            v[j].norm.y = f[i][1][0]*t[j].norm.x + f[i][1][1]*t[j].norm.y + f[i][1][2]*t[j].norm.z;
+            v[j].norm.z = f[i][2][0]*t[j].norm.x + f[i][2][1]*t[j].norm.y + f[i][2][2]*t[j].norm.z;
+            v[j].uv.x = t[j].uv.x;
+            v[j].uv.y = t[j].uv.y;
+            v[j].col.r = colors[i][0];
+            v[j].col.g = colors[i][1];
+            v[j].col.b = colors[i][2];
+            v[j].col.a = colors[i][3];
         }
+        vertex_buffer_add_n(&mo->vb, v, 4);
     }
     index_buffer_add_primitves(&mo->ib, primitive_topology_quads, 6, idx);
 }
@@ -219,94 +930,394 @@ static float degrees_to_radians(float a) { return a * M_PI / 180.0f; }
 
 static void model_matrix_transform(mat4x4 m, vec3 scale, vec3 trans, vec3 rot)
 {
-    mat4x4_identity(m);
-    mat4x4_scale_aniso(m, m, scale[0], scale[1], scale[2]);
-    mat4x4_translate_in_place(m, trans[0], trans[1], trans[2]);
-    mat4x4_rotate_X(m, m, degrees_to_radians(rot[0]));
-    mat4x4_rotate_Y(m, m, degrees_to_radians(rot[1]));
-    mat4x4_rotate_Z(m, m, degrees_to_radians(rot[2]));
+    vec3 rad = { degrees_to_radians(rot[0]), degrees_to_radians(rot[1]),
+                 degrees_to_radians(rot[2]) };
+    mat4x4_compose_trs(m, scale, trans, rad);
+}
+
+/*
+ * compute instance transforms begin..end for a cubic grid of objects
+ * centred on the origin. a single instance is drawn untinted at the origin.
+ */
+static void model_update_instances(model_object_t *mo, instance *inst, float t,
+    uint begin, uint end)
+{
+    uint n = (uint)ceilf(cbrtf((float)mo->instance_count));
+    float spacing = 10.0f, origin = -0.5f * spacing * (n - 1);
+
+    for (uint i = begin; i < end; i++) {
+        uint x = i % n, y = (i / n) % n, z = i / (n * n);
+        float fx = n > 1 ? (float)x / (n - 1) : 0.0f;
+        float fy = n > 1 ? (float)y / (n - 1) : 0.0f;
+        float fz = n > 1 ? (float)z / (n - 1) : 0.0f;
+        float phase = t + 7.0f * i;
+        vec3 scale = { 1.0f, 1.0f, 1.0f };
+        vec3 trans = { origin + spacing * x, origin + spacing * y,
+                       origin + spacing * z };
+        vec3 rot = { 0.25f * phase, 0.5f * phase, 0.75f * phase };
+
+        model_matrix_transform(inst[i].m, scale, trans, rot);
+        inst[i].col = (vec4f){ 1.0f - 0.5f * fx, 1.0f - 0.5f * fy,
+                               1.0f - 0.5f * fz, 1.0f };
+    }
+}
+
+static void model_update_instances_job(void *arg, uint begin, uint end)
+{
+    model_object_t *mo = (model_object_t*)arg;
+    model_update_instances(mo, mo->instance_map, mo->instance_time, begin, end);
+}
+
+static size_t uniform_align_size(size_t size)
+{
+    return (size + uniform_align - 1) / uniform_align * uniform_align;
+}
+
+/*
+ * write the per-frame uniform block into the uniform stream and bind it.
+ * the uniform stream region holds one frame block followed by one object
+ * block per model object, each aligned to the uniform buffer alignment.
+ */
+static void frame_update_uniforms(app_window *win)
+{
+    size_t offset;
+    stream_buffer_begin_frame(&uniform_stream);
+    frame_uniforms *fu = (frame_uniforms*)stream_buffer_alloc(&uniform_stream,
+        sizeof(frame_uniforms), uniform_align, &offset);
+    if (!fu) {
+        Panic("uniform stream allocation failed\n");
+    }
+    mat4x4_dup(fu->projection, win->p);
+    mat4x4_dup(fu->view, v);
+    fu->lightpos = (vec4f){ 5.f, 5.f, 10.f, 1.f };
+    uniform_block_range_slot(block_slots[block_frame], uniform_stream.obj,
+        offset, sizeof(frame_uniforms));
+}
+
+/*
+ * instance transforms are written straight into the mapped instance stream
+ * by the job system, and must be joined with model_commit_matrices.
+ */
+static void model_update_matrices(model_object_t *mo, float t)
+{
+    mo->instance_time = t;
+    stream_buffer_begin_frame(&mo->instance_stream);
+    mo->instance_map = (instance*)stream_buffer_alloc(&mo->instance_stream,
+        mo->instance_count * sizeof(instance), sizeof(instance),
+        &mo->instance_offset);
+    if (!mo->instance_map) {
+        Panic("instance stream allocation failed\n");
+    }
+    job_system_parallel_for(&jobs, model_update_instances_job, mo,
+        mo->instance_count, INSTANCE_JOB_GRAIN);
+
+    object_uniforms *ou = (object_uniforms*)stream_buffer_alloc(
+        &uniform_stream, sizeof(object_uniforms), uniform_align,
+        &mo->uniform_offset);
+    if (!ou) {
+        Panic("uniform stream allocation failed\n");
+    }
+    mat4x4_dup(ou->model, mo->m);
 }
 
-static void model_update_matrices(model_object_t *mo)
+static void model_commit_matrices(model_object_t *mo)
 {
-    uniform_matrix_4fv("u_model", (const GLfloat *)mo[0].m);
-    uniform_matrix_4fv("u_view", (const GLfloat *)mo[0].v);
+    stream_buffer_flush(&mo->instance_stream);
+    mo->instance_map = NULL;
+    gl_bind_vertex_array(mo->vao);
+    model_object_instance_pointers(mo, mo->instance_offset);
 }
 
 static void model_object_draw(model_object_t *mo)
 {
-    glBindBuffer(GL_ARRAY_BUFFER, mo->vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mo->ibo);
-    vertex_array_pointer("a_pos", 3, GL_FLOAT, 0, sizeof(vertex), offsetof(vertex,pos));
-    vertex_array_pointer("a_normal", 3, GL_FLOAT, 0, sizeof(vertex), offsetof(vertex,norm));
-    vertex_array_pointer("a_uv", 2, GL_FLOAT, 0, sizeof(vertex), offsetof(vertex,uv));
-    vertex_array_pointer("a_color", 4, GL_FLOAT, 0, sizeof(vertex), offsetof(vertex,col));
-    glDrawElements(GL_TRIANGLES, (GLsizei)mo->ib.count, GL_UNSIGNED_INT, (void*)0);
+    uniform_block_range_slot(block_slots[block_object], uniform_stream.obj,
+        mo->uniform_offset, sizeof(object_uniforms));
+    gl_bind_vertex_array(mo->vao);
+    glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)mo->index_count,
+        mo->index_type, (void*)0, (GLsizei)mo->instance_count);
+}
+
+static void dynres_set_scale(app_window *win, float scale, long cost,
+    long budget)
+{
+    if (scale < dynres_min_scale) scale = dynres_min_scale;
+    if (scale > 1.0f) scale = 1.0f;
+    Debug("[%lu/%ld] DynamicResolution: scale=%.2f->%.2f cost=%ld "
+        "budget=%ld\n", frame_number, current_time, win->render_scale, scale,
+        cost, budget);
+    win->render_scale = scale;
+    win->dynres_over = win->dynres_under = 0;
+    win->dynres_settle = DYNRES_SETTLE_FRAMES;
+}
+
+static void dynres_update(app_window *win)
+{
+    long budget = (long)(1e6f / window_auto_rate(win));
+    long cost = have_gpu_timer ? timing_series_ewma(&win->gpu_time_buffer) :
+        timing_series_ewma(&win->render_time_buffer);
+
+    if (cost <= 0) return;
+    if (win->dynres_settle > 0) {
+        win->dynres_settle--;
+        return;
+    }
+
+    /* cost is assumed to be proportional to the number of pixels */
+    float scale = win->render_scale;
+    float up = scale + dynres_step;
+    float predicted = cost * (up * up) / (scale * scale);
+
+    if (cost > budget * dynres_high) {
+        win->dynres_under = 0;
+        if (++win->dynres_over >= DYNRES_TRIGGER_FRAMES &&
+            scale > dynres_min_scale) {
+            dynres_set_scale(win, scale - dynres_step, cost, budget);
+        }
+    } else if (scale < 1.0f && predicted < budget * dynres_low) {
+        win->dynres_over = 0;
+        if (++win->dynres_under >= DYNRES_RECOVER_FRAMES) {
+            dynres_set_scale(win, scale + dynres_step, cost, budget);
+        }
+    } else {
+        win->dynres_over = win->dynres_under = 0;
+    }
 }
 
-void reshape(int width, int height)
+void reshape(app_window *win, int width, int height)
 {
     float h = (float)height / (float)width;
 
     glViewport(0, 0, (GLint) width, (GLint) height);
-    mat4x4_frustum(p, -1., 1., -h, h, 5.f, 1e9f);
-    uniform_matrix_4fv("u_projection", (const GLfloat *)p);
+    mat4x4_frustum(win->p, -1., 1., -h, h, 5.f, 1e9f);
 }
 
-static void draw_frame()
+static void draw_frame(app_window *win)
 {
-    if (current_width != width || current_height != height) {
-        reshape(width, height);
-        current_width = width;
-        current_height = height;
+    if (win->current_width != win->width ||
+        win->current_height != win->height) {
+        reshape(win, win->width, win->height);
+        win->current_width = win->width;
+        win->current_height = win->height;
+        win->dynres_settle = DYNRES_SETTLE_FRAMES;
+    }
+
+    /* the blit always fills the window at its current size, so frames
+     * answering a sync request match the configured size at any scale */
+    int scaled = 0;
+    if (use_dynamic_resolution) {
+        dynres_update(win);
+        scaled = win->render_scale < 1.0f;
+    }
+    if (scaled) {
+        int w = (int)(win->width * win->render_scale + 0.5f);
+        int h = (int)(win->height * win->render_scale + 0.5f);
+        render_target_resize(&win->scene_target, w > 1 ? w : 1,
+            h > 1 ? h : 1);
+        render_target_bind(&win->scene_target);
     }
 
     if (animation) {
         /* avoid overflow due to deltas > one second */
-        t += (delta_time % 1000000u) * 60.0f / 1e6f;
+        win->t += (win->delta_time % 1000000u) * 60.0f / 1e6f;
     }
 
     glClearColor(0.11f, 0.54f, 0.54f, 1.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    gpu_timer_mark(win, gpu_mark_clear);
 
-    vec3 model_scale = { 1.0f, 1.0f, 1.0f };
-    vec3 model_trans = { 0.0f, 0.0f, 0.0f };
-    vec3 model_rot = { 0.25f * t, 0.5f * t, 0.75f * t };
+    gl_use_program(program);
+
+    float grid = ceilf(cbrtf((float)mo[0].instance_count));
     vec3 view_scale = { 1.0f, 1.0f, 1.0f };
-    vec3 view_trans = { 0.0f, 0.0f, -32.0f };
+    vec3 view_trans = { 0.0f, 0.0f, -32.0f * grid };
     vec3 view_rot = { 0.0f, 0.0f, 0.0f };
 
-    model_matrix_transform(mo[0].m, model_scale, model_trans, model_rot);
-    model_matrix_transform(mo[0].v, view_scale, view_trans, view_rot);
-    model_update_matrices(&mo[0]);
+    model_matrix_transform(v, view_scale, view_trans, view_rot);
+    frame_update_uniforms(win);
+    model_update_matrices(&mo[0], win->t);
+
+    /* join instance jobs before the instance stream is unmapped, which
+     * is always before begin_frame so no job spans a frame boundary */
+    job_system_wait(&jobs);
+    model_commit_matrices(&mo[0]);
+    stream_buffer_flush(&uniform_stream);
     model_object_draw(&mo[0]);
+
+    if (scaled) {
+        render_target_blit(&win->scene_target, win->width, win->height);
+    }
 }
 
-static void init()
+/*
+ * fence per-frame streamed data at the end of the frame
+ */
+static void end_draw_frame()
 {
-    GLuint shaders[2];
-
-    /* shader program */
-    shaders[0] = compile_shader(GL_VERTEX_SHADER, vert_shader_filename);
-    shaders[1] = compile_shader(GL_FRAGMENT_SHADER, frag_shader_filename);
-    program = link_program(shaders, 2, NULL);
+    stream_buffer_end_frame(&mo[0].instance_stream);
+    stream_buffer_end_frame(&uniform_stream);
+}
 
-    /* create cube vertex and index buffers and buffer objects */
-    model_object_init(&mo[0]);
-    model_object_cube(&mo[0], 3.f, (vec4f){0.3f, 0.3f, 0.3f, 1.f});
-    model_object_freeze(&mo[0]);
+static void shader_define_set(const char *name, int value)
+{
+    shader_define *def = NULL;
 
-    /* set light position uniform */
-    glUseProgram(program);
-    uniform_3f("u_lightpos", 5.f, 5.f, 10.f);
+    for (uint i = 0; i < num_shader_defines; i++) {
+        if (strcmp(shader_defines[i].name, name) == 0) {
+            def = &shader_defines[i];
+        }
+    }
+    if (!def) {
+        if (num_shader_defines == MAX_SHADER_DEFINES) {
+            Panic("too many shader defines\n");
+        }
+        def = &shader_defines[num_shader_defines++];
+        def->name = name;
+        def->constant_id = -1;
+        for (size_t i = 0; i < array_size(shader_constants); i++) {
+            if (strcmp(shader_constants[i].name, name) == 0) {
+                def->constant_id = shader_constants[i].constant_id;
+            }
+        }
+    }
+    def->value = value;
+}
 
-    /* enable OpenGL capabilities */
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH_TEST);
+static int shader_define_value(const char *name, int default_value)
+{
+    for (uint i = 0; i < num_shader_defines; i++) {
+        if (strcmp(shader_defines[i].name, name) == 0) {
+            return shader_defines[i].value;
+        }
+    }
+    return default_value;
 }
 
 /*
- * X11 events
+ * noise lookup table
+ *
+ * the noise texture replaces the per fragment hash with one fetch from a
+ * tiling table of hashed values. nearest filtering keeps the grain of the
+ * hash, and 8-bit texels in a 256x256 table fit in 64KiB of cache.
+ */
+enum { NOISE_LUT_SIZE = 256 };
+
+static GLuint noise_texture;
+
+static uint32_t noise_lut_hash(uint32_t x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static void noise_lut_init()
+{
+    uint8_t *texels = (uint8_t*)malloc(NOISE_LUT_SIZE * NOISE_LUT_SIZE);
+
+    for (uint y = 0; y < NOISE_LUT_SIZE; y++) {
+        for (uint x = 0; x < NOISE_LUT_SIZE; x++) {
+            texels[y * NOISE_LUT_SIZE + x] = noise_lut_hash(x | (y << 16)) >> 24;
+        }
+    }
+
+    /* u_noise is never assigned so it samples texture unit zero */
+    glGenTextures(1, &noise_texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, noise_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, NOISE_LUT_SIZE, NOISE_LUT_SIZE, 0,
+        GL_RED, GL_UNSIGNED_BYTE, texels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    free(texels);
+}
+
+/*
+ * program binaries are cached in $XDG_CACHE_HOME/gl2_xsync by default
+ */
+static const char* default_shader_cache_dir()
+{
+    const char *xdg_cache = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if (xdg_cache && xdg_cache[0]) {
+        snprintf(shader_cache_path, sizeof(shader_cache_path),
+            "%s/gl2_xsync", xdg_cache);
+    } else if (home && home[0]) {
+        snprintf(shader_cache_path, sizeof(shader_cache_path),
+            "%s/.cache/gl2_xsync", home);
+    } else {
+        return NULL;
+    }
+    return shader_cache_path;
+}
+
+static void init()
+{
+    const shader_source sources[2] = {
+        { GL_VERTEX_SHADER, vert_shader_filename },
+        { GL_FRAGMENT_SHADER, frag_shader_filename },
+    };
+
+    /* shader program */
+    if (use_shader_cache && !shader_cache_dir) {
+        shader_cache_dir = default_shader_cache_dir();
+    }
+    shader_variant variant = { shader_defines, num_shader_defines };
+    program = link_program_variant(sources, 2, &variant, NULL, &cube_slots,
+        use_shader_cache ? shader_cache_dir : NULL);
+    for (uint i = 0; i < num_shader_defines; i++) {
+        Debug("shader define: %s=%d constant_id=%d\n", shader_defines[i].name,
+            shader_defines[i].value, shader_defines[i].constant_id);
+    }
+    if (shader_define_value("NOISE", noise_hash) == noise_lut) {
+        noise_lut_init();
+    }
+
+    /* instance transforms are computed by the job system */
+    if (job_system_init(&jobs, num_job_threads < 0 ?
+            job_system_default_threads() : (uint)num_job_threads) < 0) {
+        Panic("Cannot create job threads\n");
+    }
+    Debug("job system: threads=%u\n", jobs.num_threads);
+
+    /* create cube vertex and index buffers and buffer objects */
+    arena_init(&scene_arena, SCENE_ARENA_BLOCK_SIZE);
+    model_object_init(&mo[0], num_instances,
+        use_scene_arena ? &scene_arena : NULL);
+    if (mesh_filename) {
+        model_object_load(&mo[0], mesh_filename);
+    } else {
+        model_object_cube(&mo[0], 3.f, (vec4f){0.3f, 0.3f, 0.3f, 1.f});
+        if (optimize_mesh) model_object_optimize(&mo[0]);
+        model_object_freeze(&mo[0]);
+    }
+
+    /* CPU side geometry is no longer needed once uploaded */
+    arena_release(&scene_arena);
+
+    /* per-frame and per-object uniform blocks are streamed each frame */
+    uniform_align = uniform_buffer_alignment();
+    stream_buffer_init(&uniform_stream, GL_UNIFORM_BUFFER,
+        uniform_align_size(sizeof(frame_uniforms)) +
+        uniform_align_size(sizeof(object_uniforms)) * array_size(mo));
+
+    /* enable OpenGL capabilities */
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+
+    gpu_timer_init();
+    Debug("Capabilities: gpu_timer=%d\n", have_gpu_timer);
+}
+
+/*
+ * X11 events
  */
 
 static const char* xevent_names[] = {
@@ -376,29 +1387,146 @@ static XVisualInfo* find_glx_visual(Display *d, int s)
     return glXChooseVisual(d, s, attribs);
 }
 
+/*
+ * atom name cache
+ *
+ * XGetAtomName is a round trip and returns a string the caller must free,
+ * so names are fetched once and kept in an open addressed table keyed by
+ * atom. the atoms we intern are seeded without asking the server, and
+ * lists of atoms are fetched in one batch with XGetAtomNames, so tracing
+ * does not add round trips to the event loop.
+ */
+
+enum { ATOM_CACHE_INITIAL_SIZE = 64 };
+
+typedef struct {
+    Atom atom;
+    char *name;
+} atom_cache_entry;
+
+static atom_cache_entry *atom_cache;
+static size_t atom_cache_size;
+static size_t atom_cache_count;
+
+static size_t atom_cache_slot(atom_cache_entry *table, size_t size, Atom atom)
+{
+    size_t i = (atom * 0x9e3779b97f4a7c15ull) >> 32;
+    for (;; i++) {
+        atom_cache_entry *e = &table[i & (size - 1)];
+        if (e->atom == atom || e->atom == None) return i & (size - 1);
+    }
+}
+
+static const char* atom_cache_find(Atom atom)
+{
+    if (atom_cache_size == 0 || atom == None) return NULL;
+    return atom_cache[atom_cache_slot(atom_cache, atom_cache_size, atom)].name;
+}
+
+static void atom_cache_insert(Atom atom, const char *name)
+{
+    if (atom == None || atom_cache_find(atom)) return;
+
+    /* keep the load factor at or below one half */
+    if ((atom_cache_count + 1) * 2 > atom_cache_size) {
+        size_t size = atom_cache_size ? atom_cache_size * 2 :
+            ATOM_CACHE_INITIAL_SIZE;
+        atom_cache_entry *table = calloc(size, sizeof(atom_cache_entry));
+        for (size_t i = 0; i < atom_cache_size; i++) {
+            if (atom_cache[i].atom == None) continue;
+            table[atom_cache_slot(table, size, atom_cache[i].atom)] =
+                atom_cache[i];
+        }
+        free(atom_cache);
+        atom_cache = table;
+        atom_cache_size = size;
+    }
+
+    atom_cache[atom_cache_slot(atom_cache, atom_cache_size, atom)] =
+        (atom_cache_entry) { atom, strdup(name) };
+    atom_cache_count++;
+}
+
+/*
+ * fetch the names of any atoms not already cached in one round trip
+ */
+static void atom_cache_fetch(Display *d, Atom *atoms, int count)
+{
+    Atom *missing = malloc(sizeof(Atom) * (count > 0 ? count : 1));
+    char **names = malloc(sizeof(char*) * (count > 0 ? count : 1));
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (atoms[i] != None && !atom_cache_find(atoms[i])) {
+            missing[n++] = atoms[i];
+        }
+    }
+    if (n > 0 && XGetAtomNames(d, missing, n, names)) {
+        for (int i = 0; i < n; i++) {
+            atom_cache_insert(missing[i], names[i]);
+            XFree(names[i]);
+        }
+    }
+
+    free(names);
+    free(missing);
+}
+
+static const char* atom_name(Display *d, Atom atom)
+{
+    const char *name = atom_cache_find(atom);
+    if (!name) {
+        atom_cache_fetch(d, &atom, 1);
+        name = atom_cache_find(atom);
+    }
+    return name ? name : "(unknown)";
+}
+
+static void atom_cache_destroy()
+{
+    for (size_t i = 0; i < atom_cache_size; i++) {
+        free(atom_cache[i].name);
+    }
+    free(atom_cache);
+    atom_cache = NULL;
+    atom_cache_size = atom_cache_count = 0;
+}
+
 /*
  * XSync extended frame synchronization
  */
 
-static int init_atoms(Display *d)
+static const struct { const char *name; Atom *atom; } atom_table[] = {
+    { "WM_PROTOCOLS", &WM_PROTOCOLS },
+    { "_NET_SUPPORTED", &_NET_SUPPORTED },
+    { "_NET_WM_MOVERESIZE", &_NET_WM_MOVERESIZE },
+    { "_NET_WM_SYNC_REQUEST", &_NET_WM_SYNC_REQUEST },
+    { "_NET_WM_SYNC_REQUEST_COUNTER", &_NET_WM_SYNC_REQUEST_COUNTER },
+    { "_NET_WM_FRAME_DRAWN", &_NET_WM_FRAME_DRAWN },
+    { "_NET_WM_FRAME_TIMINGS", &_NET_WM_FRAME_TIMINGS },
+    { "_NET_WM_PING", &_NET_WM_PING },
+};
+
+/*
+ * intern all atoms with one batch of requests, so startup pays for one
+ * round trip instead of one per atom.
+ */
+static void init_atoms(Display *d)
 {
-    WM_PROTOCOLS = XInternAtom(d, "WM_PROTOCOLS", False);
-    _NET_SUPPORTED = XInternAtom(d, "_NET_SUPPORTED", False);
-    _NET_WM_MOVERESIZE = XInternAtom(d, "_NET_WM_MOVERESIZE", False);
-    _NET_WM_SYNC_REQUEST = XInternAtom(d, "_NET_WM_SYNC_REQUEST", False);
-    _NET_WM_SYNC_REQUEST_COUNTER = XInternAtom(d, "_NET_WM_SYNC_REQUEST_COUNTER", False);
-    _NET_WM_FRAME_DRAWN = XInternAtom(d, "_NET_WM_FRAME_DRAWN", False);
-    _NET_WM_FRAME_TIMINGS = XInternAtom(d, "_NET_WM_FRAME_TIMINGS", False);
-    _NET_WM_PING = XInternAtom(d, "_NET_WM_PING", False);
+    char *names[array_size(atom_table)];
+    Atom atoms[array_size(atom_table)];
 
-    assert(WM_PROTOCOLS);
-    assert(_NET_SUPPORTED);
-    assert(_NET_WM_MOVERESIZE);
-    assert(_NET_WM_SYNC_REQUEST);
-    assert(_NET_WM_SYNC_REQUEST_COUNTER);
-    assert(_NET_WM_FRAME_DRAWN);
-    assert(_NET_WM_FRAME_TIMINGS);
-    assert(_NET_WM_PING);
+    for (size_t i = 0; i < array_size(atom_table); i++) {
+        names[i] = (char*)atom_table[i].name;
+    }
+    if (!XInternAtoms(d, names, array_size(atom_table), False, atoms)) {
+        Panic("Cannot intern atoms\n");
+    }
+    for (size_t i = 0; i < array_size(atom_table); i++) {
+        assert(atoms[i]);
+        *atom_table[i].atom = atoms[i];
+        atom_cache_insert(atoms[i], names[i]);
+    }
 }
 
 static ulong get_time_microseconds()
@@ -423,343 +1551,1771 @@ static void update_wm_supported(Display *d, int s)
     have_net_supported = (type == XA_ATOM && supported_atoms != NULL &&
                       num_supported_atoms > 0);
 
-    for (int i = 0; i < num_supported_atoms; i++) {
-        Trace("Atom: %s (%ld)\n",
-            XGetAtomName(d, supported_atoms[i]), supported_atoms[i]);
-    }
+    if (trace && have_net_supported) {
+        atom_cache_fetch(d, supported_atoms, (int)num_supported_atoms);
+    }
+    for (int i = 0; i < num_supported_atoms; i++) {
+        Trace("Atom: %s (%ld)\n",
+            atom_name(d, supported_atoms[i]), supported_atoms[i]);
+    }
+}
+
+static int check_wm_supported(Atom atom)
+{
+    if (!have_net_supported) return 0;
+
+    for (int i = 0; i < num_supported_atoms; i++) {
+        if (supported_atoms[i] == atom)return 1;
+    }
+}
+
+static void update_wm_protocols(Display *d, Window w)
+{
+    Atom protocols[] = { _NET_WM_PING, _NET_WM_SYNC_REQUEST };
+
+    XSetWMProtocols(d, w, protocols, array_size(protocols));
+}
+
+static void update_wm_hints(Display *d, Window w)
+{
+    XWMHints wm_hints;
+
+    wm_hints.flags = StateHint | InputHint;
+    wm_hints.input = True;
+    wm_hints.initial_state = NormalState;
+
+    XSetWMHints(d, w, &wm_hints);
+}
+
+static void sync_init(Display *d)
+{
+    int major, minor;
+
+    have_xsync_extension =
+        (XSyncQueryExtension(d, &xsync_event_base, &xsync_error_base) &&
+         XSyncInitialize(d, &major, &minor));
+}
+
+/*
+ * create the basic and extended counters of a window
+ */
+static void sync_init_window(Display *d, app_window *win)
+{
+    XSyncValue value;
+    XID counters[2];
+
+    if (!have_xsync_extension) return;
+
+    XSyncIntToValue (&value, 0);
+    win->update_counter = XSyncCreateCounter(d, value);
+    win->extended_counter = XSyncCreateCounter(d, value);
+
+    counters[0] = win->update_counter;
+    counters[1] = win->extended_counter;
+
+    XChangeProperty(d, win->w, _NET_WM_SYNC_REQUEST_COUNTER, XA_CARDINAL,
+           32, PropModeReplace, (unsigned char*)counters, 2);
+}
+
+/*
+ * probe for Present, falling back to compositor timings if the server
+ * does not support the extension
+ */
+static void present_init(Display *d)
+{
+    have_present_extension = x11_present_init(d, &present) == 0;
+
+    if (!have_present_extension) {
+        timing_source = timing_ewmh;
+    }
+}
+
+static void present_init_window(Display *d, app_window *win)
+{
+    if (!have_present_extension) return;
+
+    win->present_eid = x11_present_select_input(d, &present, win->w,
+        PresentCompleteNotifyMask | PresentIdleNotifyMask);
+}
+
+static void sync_counter(Display *d, XSyncCounter counter, ulong value)
+{
+    XSyncValue sync_value;
+
+    if (!have_xsync_extension) return;
+
+    XSyncIntsToValue(&sync_value, value & 0xFFFFFFFF, value >> 32);
+    XSyncSetCounter(d, counter, sync_value);
+}
+
+typedef enum { frame_normal, frame_urgent } frame_disposition;
+
+/*
+ * update vblank phase and period estimate from compositor frame timings
+ *
+ * drawn_time and presentation_offset are CLOCK_MONOTONIC microseconds so
+ * the presentation time of the frame is a vblank on our own clock.
+ */
+static void vblank_update(app_window *win, ulong sync_serial,
+    long presentation_offset, long refresh_interval)
+{
+    if (refresh_interval > 0) {
+        win->vblank_interval = win->vblank_interval == 0 ? refresh_interval :
+            (win->vblank_interval * 7 + refresh_interval) / 8;
+    }
+    if (presentation_offset > 0 && sync_serial == win->frame_drawn_serial) {
+        win->vblank_time = win->frame_drawn_time + presentation_offset;
+    }
+}
+
+/*
+ * predict the first vblank at or after time t
+ */
+static long vblank_predict(app_window *win, long t)
+{
+    long interval = win->vblank_interval;
+    long v = win->vblank_time + ((t - win->vblank_time) / interval) * interval;
+    return v < t ? v + interval : v;
+}
+
+/*
+ * schedule the next paced frame
+ *
+ * the clock scheduler simply adds the target frame period to the start
+ * time of the current frame. the vblank scheduler rounds the period to a
+ * whole number of refresh intervals and aims to start drawing at a fixed
+ * lead before the predicted vblank. after urgent frames have displaced the
+ * schedule, the phase error is eased out by at most 1/8th of a refresh
+ * interval per frame instead of snapping back with a doubled frame.
+ */
+static void schedule_frame(app_window *win, float target_frame_rate)
+{
+    long period = (long)(1e6f / target_frame_rate);
+    long clock_time = win->last_draw_time + period;
+
+    if (scheduler != schedule_vblank || win->vblank_interval == 0 ||
+        win->vblank_time == 0) {
+        win->next_draw_time = clock_time;
+        return;
+    }
+
+    long divisor = (period + win->vblank_interval / 2) / win->vblank_interval;
+    if (divisor < 1) divisor = 1;
+
+    long current_vblank = vblank_predict(win, win->last_draw_time +
+        vblank_lead - win->vblank_interval / 2);
+    long vblank_draw_time = current_vblank + divisor * win->vblank_interval -
+        vblank_lead;
+
+    long phase_error = vblank_draw_time - clock_time;
+    long phase_slew = win->vblank_interval / 8;
+    if (phase_error > phase_slew) phase_error = phase_slew;
+    if (phase_error < -phase_slew) phase_error = -phase_slew;
+
+    win->next_draw_time = clock_time + phase_error;
+
+    Trace("[%lu/%ld] Schedule: vblank_time=%ld vblank_interval=%ld "
+        "divisor=%ld phase_error=%ld next_draw_time=%ld\n",
+        frame_number, current_time, win->vblank_time, win->vblank_interval,
+        divisor, vblank_draw_time - clock_time, win->next_draw_time);
+}
+
+/*
+ * inform the compositor that we are starting to draw a frame
+ */
+static void begin_frame(Display *d, app_window *win,
+    frame_disposition disposition)
+{
+    /* extended synchronization in response to _NET_WM_SYNC_REQUEST */
+    if (win->configure_sync_serial != 0 && win->configure_extended_sync)
+    {
+        win->current_sync_serial = win->configure_sync_serial;
+        win->configure_sync_serial = 0;
+    }
+    /* advance frame to next multiple of 4 */
+    if ((win->current_sync_serial & 3) != 0) {
+        win->current_sync_serial = (win->current_sync_serial + 3) & ~3;
+    }
+    /* advance frame to odd value, 1 = normal, 3 = urgent */
+    win->inflight_sync_serial = win->current_sync_serial + 4;
+    win->current_sync_serial += (disposition == frame_urgent ? 3 : 1);
+    sync_counter(d, win->extended_counter, win->current_sync_serial);
+}
+
+/*
+ * inform the compositor that we have finished drawing a frame
+ */
+static void end_frame(Display *d, app_window *win)
+{
+    /* extended synchronization */
+    if ((win->current_sync_serial & 3) == 1) {
+        win->current_sync_serial += 3;
+        sync_counter(d, win->extended_counter, win->current_sync_serial);
+    } else if ((win->current_sync_serial & 3) == 3) {
+        win->current_sync_serial += 1;
+        sync_counter(d, win->extended_counter, win->current_sync_serial);
+    }
+
+    /* basic synchronization */
+    if (win->configure_sync_serial != 0 && win->configure_extended_sync) {
+        sync_counter(d, win->update_counter, win->configure_sync_serial);
+        win->configure_sync_serial = 0;
+        win->configure_extended_sync = 0;
+    }
+}
+
+/*
+ * inflight frame ring
+ *
+ * each submitted frame records its extended counter serial and, when
+ * pipelining, a fence after the swap. frames are retired when timings
+ * for their serial arrive. with max_inflight == 1 this is equivalent to
+ * waiting for timings of the previous frame before drawing the next.
+ */
+static uint inflight_count(app_window *win)
+{
+    return win->inflight_head - win->inflight_tail;
+}
+
+static inflight_frame* inflight_oldest(app_window *win)
+{
+    return &win->inflight_ring[win->inflight_tail % MAX_INFLIGHT_FRAMES];
+}
+
+static void inflight_pop(app_window *win)
+{
+    inflight_frame *f = inflight_oldest(win);
+    if (f->fence) {
+        glDeleteSync(f->fence);
+        f->fence = 0;
+    }
+    win->inflight_tail++;
+}
+
+static void inflight_retire(app_window *win)
+{
+    while (inflight_count(win) > 0 &&
+           inflight_oldest(win)->sync_serial <= win->timing_sync_serial) {
+        inflight_pop(win);
+    }
+}
+
+static void inflight_push(app_window *win, ulong sync_serial, long submit_time,
+    long input_time)
+{
+    /* without compositor timings we can only bound the GPU queue */
+    if (inflight_count(win) >= max_inflight) {
+        inflight_frame *f = inflight_oldest(win);
+        if (f->fence) {
+            glClientWaitSync(f->fence, GL_SYNC_FLUSH_COMMANDS_BIT, ~0ull);
+        }
+        inflight_pop(win);
+    }
+    inflight_frame *f =
+        &win->inflight_ring[win->inflight_head++ % MAX_INFLIGHT_FRAMES];
+    f->sync_serial = sync_serial;
+    f->submit_time = submit_time;
+    f->input_time = input_time;
+    f->fence = max_inflight > 1 ?
+        glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+}
+
+static inflight_frame* inflight_find(app_window *win, ulong sync_serial)
+{
+    for (uint i = win->inflight_tail; i != win->inflight_head; i++) {
+        inflight_frame *f = &win->inflight_ring[i % MAX_INFLIGHT_FRAMES];
+        if (f->sync_serial == sync_serial) return f;
+    }
+    return NULL;
+}
+
+/*
+ * queue the sync serial of a swap to be matched with its CompleteNotify
+ */
+static void present_frame_submitted(Display *d, app_window *win,
+    ulong sync_serial)
+{
+    if (timing_source != timing_present) return;
+
+    if (win->present_pending_head - win->present_pending_tail ==
+        PRESENT_PENDING_FRAMES) {
+        win->present_pending_tail++;
+    }
+    uint slot = win->present_pending_head++ % PRESENT_PENDING_FRAMES;
+    win->present_pending[slot] = sync_serial;
+
+    /* swaps are not presented with PresentPixmap, ask for the next vblank */
+    if (!win->have_present_pixmap) {
+        x11_present_notify_msc(d, &present, win->w, (uint32_t)sync_serial,
+            0, 0, 0);
+    }
+}
+
+/*
+ * live metrics
+ *
+ * after each frame the statistics of the window are summarized into its
+ * slot in the metrics file. summaries are lookups in the sorted windows of
+ * the timing series and the update is plain stores into the shared mapping,
+ * so publishing makes no system calls and never waits on a collector.
+ */
+static void metrics_series_store(frame_metrics_series *ms, timing_series *ts)
+{
+    ms->count = ts->count;
+    ms->last = timing_series_last(ts);
+    ms->min = timing_series_min(ts);
+    ms->p50 = timing_series_median(ts);
+    ms->p95 = timing_series_percentile(ts, 95);
+    ms->p99 = timing_series_percentile(ts, 99);
+    ms->max = timing_series_max(ts);
+    ms->mean = timing_series_mean(ts);
+}
+
+static void metrics_publish(app_window *win)
+{
+    frame_metrics_window *mw;
+
+    if (!metrics_file.header) return;
+    if (!(mw = frame_metrics_begin(&metrics_file, win->index))) return;
+
+    mw->frames++;
+    mw->sync_serial = win->current_sync_serial;
+    mw->update_time = current_time;
+    mw->width = win->width;
+    mw->height = win->height;
+    metrics_series_store(&mw->series[metrics_frame_time],
+        &win->frame_time_buffer);
+    metrics_series_store(&mw->series[metrics_render_time],
+        &win->render_time_buffer);
+    metrics_series_store(&mw->series[metrics_gpu_time],
+        &win->gpu_time_buffer);
+    metrics_series_store(&mw->series[metrics_compositor_latency],
+        &win->compositor_latency_buffer);
+    metrics_series_store(&mw->series[metrics_input_latency],
+        &win->input_latency_buffer);
+    frame_metrics_end(&metrics_file);
+}
+
+/*
+ * scripted compositor
+ *
+ * --bench replaces the window manager with a compositor script that runs
+ * in process. it injects _NET_WM_SYNC_REQUEST and ConfigureNotify storms,
+ * _NET_WM_FRAME_DRAWN and _NET_WM_FRAME_TIMINGS into the Xlib event queue
+ * with XPutBackEvent, so they pass through process_event and coalescing
+ * like events sent by a compositor. the script repaints on a fixed refresh
+ * interval: a frame that ends at t is composited at the first repaint after
+ * t plus the latency and a uniform random jitter, is drawn at the repaint
+ * and its timings are sent just after the vblank. a frame superseded
+ * before its repaint is dropped and a frame presented more than half a
+ * refresh interval after its slot is late.
+ *
+ * the script also checks the counter protocol as a compositor sees it: the
+ * extended counter must increase, frames must end on a multiple of 4, the
+ * frame answering a sync request must end past the requested serial, and
+ * it must not be submitted while earlier frames await timings.
+ */
+
+enum {
+    SCRIPT_REFRESH_INTERVAL = 16667,
+    SCRIPT_REPAINT_LEAD = 2000,
+    SCRIPT_TIMINGS_DELAY = 500,
+    SCRIPT_SYNC_AHEAD = 240,
+    SCRIPT_STORM_EVENTS = 8,
+    SCRIPT_STORM_STEP = 8,
+    SCRIPT_MAX_PENDING = 16,
+    SCRIPT_MAX_EVENTS = 64
+};
+
+typedef struct {
+    ulong sync_serial;
+    long end_time;
+    long repaint_time;
+    long vblank_time;
+    int drawn_sent;
+} script_frame;
+
+typedef struct {
+    script_frame pending[SCRIPT_MAX_PENDING];
+    uint head, tail;
+    ulong last_counter;
+    ulong request_serial;
+    long storm_time;
+    int storm_grow;
+    long last_vblank_time;
+} script_window;
+
+static ulong bench_frames;
+static long script_latency = 1000;
+static long script_jitter;
+static uint script_storm_interval;
+static script_window script_windows[MAX_WINDOWS];
+static XEvent script_events[SCRIPT_MAX_EVENTS];
+static uint script_event_count;
+static ulong script_sync_requests, script_dropped, script_late;
+static ulong script_violations;
+static long *script_frame_times, *script_render_times;
+static ulong script_frame_count;
+
+static void script_violation(app_window *win, const char *reason,
+    ulong sync_serial)
+{
+    script_violations++;
+    Debug("[%lu/%ld] Script: violation window=%u sync_serial=%lu %s\n",
+        frame_number, current_time, win->index, sync_serial, reason);
+}
+
+static XEvent* script_event(Display *d, app_window *win, int type)
+{
+    if (script_event_count == SCRIPT_MAX_EVENTS) {
+        Panic("script event overflow\n");
+    }
+    XEvent *e = &script_events[script_event_count++];
+    memset(e, 0, sizeof(XEvent));
+    e->xany.type = type;
+    e->xany.send_event = True;
+    e->xany.display = d;
+    e->xany.window = win->w;
+    return e;
+}
+
+static void script_client_message(Display *d, app_window *win, Atom type,
+    long l0, long l1, long l2, long l3, long l4)
+{
+    XEvent *e = script_event(d, win, ClientMessage);
+    e->xclient.message_type = type;
+    e->xclient.format = 32;
+    e->xclient.data.l[0] = l0;
+    e->xclient.data.l[1] = l1;
+    e->xclient.data.l[2] = l2;
+    e->xclient.data.l[3] = l3;
+    e->xclient.data.l[4] = l4;
+}
+
+/*
+ * a storm is a burst of sync requests, each followed by a configure at
+ * a new size, then an expose, as sent during an interactive resize. the
+ * sizes step from the window's current size, shrinking and growing on
+ * alternate storms so that the size stays bounded.
+ */
+static void script_storm(Display *d, app_window *win, script_window *sw)
+{
+    ulong base = (sw->last_counter + 3) & ~3ul;
+
+    for (uint i = 0; i < SCRIPT_STORM_EVENTS; i++) {
+        ulong serial = base + SCRIPT_SYNC_AHEAD * (i + 1);
+        script_client_message(d, win, WM_PROTOCOLS, _NET_WM_SYNC_REQUEST,
+            CurrentTime, serial & 0xffffffff, serial >> 32, 1);
+        XEvent *e = script_event(d, win, ConfigureNotify);
+        e->xconfigure.event = win->w;
+        int step = SCRIPT_STORM_STEP * (i + 1) * (sw->storm_grow ? 1 : -1);
+        e->xconfigure.width = win->width + step > 1 ? win->width + step : 1;
+        e->xconfigure.height = win->height + step > 1 ? win->height + step : 1;
+        sw->request_serial = serial;
+        script_sync_requests++;
+    }
+    sw->storm_grow = !sw->storm_grow;
+    script_event(d, win, Expose);
+}
+
+/*
+ * observe the counter at the end of a frame and queue it for compositing
+ */
+static void script_frame_submitted(Display *d, app_window *win)
+{
+    if (!bench_frames) return;
+
+    script_window *sw = &script_windows[win->index];
+    ulong counter = win->current_sync_serial;
+
+    if (counter <= sw->last_counter) {
+        script_violation(win, "counter did not increase", counter);
+    }
+    if ((counter & 3) != 0) {
+        script_violation(win, "frame did not end on a multiple of 4", counter);
+    }
+    if (sw->request_serial != 0) {
+        if (counter <= sw->request_serial) {
+            script_violation(win, "sync request not answered", counter);
+        }
+        if (sw->head != sw->tail) {
+            script_violation(win, "answer submitted before timings", counter);
+        }
+        sw->request_serial = 0;
+    }
+    sw->last_counter = counter;
+
+    if (script_frame_times && script_frame_count < bench_frames) {
+        script_frame_times[script_frame_count] = win->delta_time;
+        script_render_times[script_frame_count] = win->render_time;
+    }
+    script_frame_count++;
+    if (script_storm_interval &&
+        script_frame_count % script_storm_interval == 0) {
+        sw->storm_time = current_time + script_latency;
+    }
+
+    /* the repaint after the frame is ready, or a frame that missed it */
+    long ready = current_time + script_latency +
+        (script_jitter > 0 ? rand() % (script_jitter + 1) : 0);
+    long vblank = ready + SCRIPT_REPAINT_LEAD;
+    vblank += (SCRIPT_REFRESH_INTERVAL - vblank % SCRIPT_REFRESH_INTERVAL) %
+        SCRIPT_REFRESH_INTERVAL;
+    long repaint = vblank - SCRIPT_REPAINT_LEAD;
+
+    if (sw->head != sw->tail) {
+        script_frame *last = &sw->pending[(sw->head - 1) % SCRIPT_MAX_PENDING];
+        if (!last->drawn_sent && last->repaint_time >= repaint) {
+            /* superseded before it was composited */
+            last->sync_serial = counter;
+            last->end_time = current_time;
+            script_dropped++;
+            return;
+        }
+    }
+    if (sw->head - sw->tail == SCRIPT_MAX_PENDING) {
+        sw->tail++;
+    }
+    sw->pending[sw->head++ % SCRIPT_MAX_PENDING] = (script_frame) {
+        counter, current_time, repaint, vblank, 0
+    };
+}
+
+/*
+ * queue script events due at time now, returns the time of the next event
+ */
+static long script_window_events(Display *d, app_window *win, long now)
+{
+    script_window *sw = &script_windows[win->index];
+    long slot = (long)(1e6f / window_auto_rate(win) + 0.5f);
+    long divisor = (slot + SCRIPT_REFRESH_INTERVAL / 2) /
+        SCRIPT_REFRESH_INTERVAL;
+    if (divisor < 1) divisor = 1;
+
+    while (sw->tail != sw->head) {
+        script_frame *f = &sw->pending[sw->tail % SCRIPT_MAX_PENDING];
+        if (!f->drawn_sent) {
+            if (now < f->repaint_time) return f->repaint_time;
+            script_client_message(d, win, _NET_WM_FRAME_DRAWN,
+                f->sync_serial & 0xffffffff, f->sync_serial >> 32,
+                f->repaint_time & 0xffffffff, f->repaint_time >> 32, 0);
+            f->drawn_sent = 1;
+        }
+        long timings_time = f->vblank_time + SCRIPT_TIMINGS_DELAY;
+        if (now < timings_time) return timings_time;
+        script_client_message(d, win, _NET_WM_FRAME_TIMINGS,
+            f->sync_serial & 0xffffffff, f->sync_serial >> 32,
+            f->vblank_time - f->repaint_time, SCRIPT_REFRESH_INTERVAL, 0);
+        if (sw->last_vblank_time && f->vblank_time - sw->last_vblank_time >
+            divisor * SCRIPT_REFRESH_INTERVAL + SCRIPT_REFRESH_INTERVAL / 2) {
+            script_late++;
+        }
+        sw->last_vblank_time = f->vblank_time;
+        sw->tail++;
+    }
+    if (sw->storm_time) {
+        if (now < sw->storm_time) return sw->storm_time;
+        sw->storm_time = 0;
+        script_storm(d, win, sw);
+    }
+    return 0;
+}
+
+/*
+ * script events due at time now into script_events, returns the time of
+ * the next event
+ */
+static long script_collect(Display *d, long now)
+{
+    long next = 0;
+
+    script_event_count = 0;
+    for (uint i = 0; i < num_windows; i++) {
+        long t = script_window_events(d, &windows[i], now);
+        if (t && (!next || t < next)) next = t;
+    }
+    return next;
+}
+
+/*
+ * XPutBackEvent pushes onto the head of the queue, so events are queued
+ * in reverse to be read in the order they were scripted
+ */
+static long script_compositor(Display *d, long now)
+{
+    long next = script_collect(d, now);
+
+    while (script_event_count > 0) {
+        XPutBackEvent(d, &script_events[--script_event_count]);
+    }
+    return next;
+}
+
+/*
+ * deferred frames
+ *
+ * a frame that must wait for timings of inflight frames is deferred until
+ * the frame timings message arrives, which moves next_draw_time back to
+ * the time the frame was deferred so it is drawn immediately. the frame
+ * deadline is otherwise pushed out to a watchdog timeout in case timings
+ * never arrive, so no wakeups occur while waiting on the compositor.
+ */
+
+enum { FRAME_DEFER_TIMEOUT = 100000 };
+
+static void frame_resume(app_window *win)
+{
+    if (!win->frame_deferred) return;
+    win->frame_deferred = 0;
+    win->next_draw_time = win->frame_deferred_time;
+}
+
+/*
+ * returns 1 if the frame must be delayed until timings arrive for
+ * inflight frames, in which case the frame is deferred.
+ */
+static int submit_frame_delayed(Display *d, app_window *win,
+    frame_disposition disposition)
+{
+    /* tearing may result if frames are submitted before receiving timings
+     * for inflight frames submitted in response to synchronization requests,
+     * so frames answering a pending request wait for all inflight frames */
+    inflight_retire(win);
+    uint inflight_limit = win->configure_sync_serial != 0 ? 1 : max_inflight;
+    if (win->timing_sync_serial > 0 && inflight_count(win) >= inflight_limit)
+    {
+        /* the counter update that ends the inflight frame is buffered by
+         * Xlib, so it must be flushed for the compositor to see it */
+        XFlush(d);
+        win->frame_deferred = 1;
+        win->frame_deferred_time = current_time;
+        win->next_draw_time = current_time + FRAME_DEFER_TIMEOUT;
+        Trace("[%lu/%ld] Delay: disposition=%s timing_sync_serial=%lu "
+            "inflight_sync_serial=%lu inflight_count=%u\n",
+            frame_number, current_time,
+            disposition == frame_urgent ? "urgent" : "normal",
+            win->timing_sync_serial, win->inflight_sync_serial,
+            inflight_count(win));
+        TraceRecord(current_time, win->index, trace_delay, disposition,
+            win->timing_sync_serial, win->inflight_sync_serial,
+            inflight_count(win));
+        return 1;
+    }
+    win->frame_deferred = 0;
+    return 0;
+}
+
+/*
+ * windows share one context, which is made current on the drawable of
+ * the window being drawn. the viewport is per context so it is restored.
+ */
+static GLXContext render_context;
+static Window current_drawable;
+
+static void window_make_current(Display *d, app_window *win)
+{
+    if (current_drawable == win->w) return;
+    glXMakeCurrent(d, win->w, render_context);
+    current_drawable = win->w;
+    glViewport(0, 0, win->current_width, win->current_height);
+}
+
+/*
+ * draw the first frame of every window immediately
+ */
+static void window_start_frames()
+{
+    current_time = get_time_microseconds();
+    for (uint i = 0; i < num_windows; i++) {
+        windows[i].next_draw_time = current_time;
+    }
+}
+
+/*
+ * submit frame for rendering
+ */
+static void submit_frame(Display *d, app_window *win,
+    frame_disposition disposition, float target_frame_rate)
+{
+    current_time = get_time_microseconds();
+
+    if (submit_frame_delayed(d, win, disposition)) {
+        return;
+    }
+
+    Trace("[%lu/%ld] FrameBegin: window=%u delta_time=%ld sync_serial=%lu "
+        "frame_p50_time=%ld render_p50_time=%ld render_p95_time=%ld\n",
+        frame_number, current_time, win->index, win->delta_time,
+        win->current_sync_serial,
+        timing_series_median(&win->frame_time_buffer),
+        timing_series_median(&win->render_time_buffer),
+        timing_series_percentile(&win->render_time_buffer, 95));
+
+    if (win->last_draw_time) {
+        win->delta_time = current_time - win->last_draw_time;
+        timing_series_add(&win->frame_time_buffer, win->delta_time);
+    }
+    win->last_draw_time = current_time;
+    schedule_frame(win, window_frame_rate(win, target_frame_rate));
+    win->frame_idle = window_idle(win);
+
+    frame_number++;
+    TraceRecord(win->last_draw_time, win->index, trace_frame_begin, disposition,
+        win->current_sync_serial, win->delta_time, 0);
+
+    /* the frame consumes input received before it started drawing */
+    long input_time = win->input_time;
+    win->input_time = 0;
+
+    window_make_current(d, win);
+    gpu_timer_collect(win);
+    gpu_timer_begin_frame(win);
+    draw_frame(win);
+    gpu_timer_mark(win, gpu_mark_draw);
+    begin_frame(d, win, disposition);
+    glXSwapBuffers(d, win->w);
+    gpu_timer_end_frame(win);
+    if (max_inflight == 1) {
+        glXWaitX();
+    }
+    end_frame(d, win);
+    end_draw_frame();
+    inflight_push(win, win->current_sync_serial, win->last_draw_time,
+        input_time);
+    present_frame_submitted(d, win, win->current_sync_serial);
+
+    current_time = get_time_microseconds();
+    win->render_time = current_time - win->last_draw_time;
+    timing_series_add(&win->render_time_buffer, win->render_time);
+    rate_update(win);
+    script_frame_submitted(d, win);
+    metrics_publish(win);
+    TraceRecord(current_time, win->index, trace_frame_end, disposition,
+        win->current_sync_serial, win->render_time, 0);
+
+    Trace("[%lu/%ld] FrameEnd: delta_time=%ld sync_serial=%lu "
+        "frame_p50_time=%ld render_p50_time=%ld render_p95_time=%ld "
+        "latency_p50_time=%ld latency_p95_time=%ld gpu_p50_time=%ld "
+        "gpu_clear_time=%ld gpu_draw_time=%ld gpu_swap_time=%ld\n",
+        frame_number, current_time, win->delta_time, win->current_sync_serial,
+        timing_series_median(&win->frame_time_buffer),
+        timing_series_median(&win->render_time_buffer),
+        timing_series_percentile(&win->render_time_buffer, 95),
+        timing_series_median(&win->compositor_latency_buffer),
+        timing_series_percentile(&win->compositor_latency_buffer, 95),
+        timing_series_median(&win->gpu_time_buffer),
+        win->gpu_clear_time, win->gpu_draw_time, win->gpu_swap_time);
+}
+
+/*
+ * event loop wakeups
+ *
+ * loops block in epoll_wait on their event source, the X connection or
+ * the render eventfd, and a timerfd armed with the absolute monotonic
+ * time of the next frame. the timer is only rearmed when the deadline
+ * changes and a zero deadline disarms it.
+ */
+
+typedef struct {
+    int epfd;
+    int timerfd;
+    long deadline;
+} wakeup_set;
+
+enum { wakeup_timer, wakeup_source };
+
+static void wakeup_init(wakeup_set *ws, int source_fd)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+
+    ws->deadline = 0;
+    ws->epfd = epoll_create1(EPOLL_CLOEXEC);
+    ws->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (ws->epfd < 0 || ws->timerfd < 0) {
+        Panic("wakeup init error: %s\n", strerror(errno));
+    }
+
+    ev.data.u32 = wakeup_timer;
+    if (epoll_ctl(ws->epfd, EPOLL_CTL_ADD, ws->timerfd, &ev) < 0) {
+        Panic("epoll_ctl error: %s\n", strerror(errno));
+    }
+    ev.data.u32 = wakeup_source;
+    if (epoll_ctl(ws->epfd, EPOLL_CTL_ADD, source_fd, &ev) < 0) {
+        Panic("epoll_ctl error: %s\n", strerror(errno));
+    }
+}
+
+static void wakeup_arm(wakeup_set *ws, long deadline)
+{
+    if (ws->deadline == deadline) return;
+
+    struct itimerspec its = {
+        .it_value = {
+            .tv_sec = deadline / 1000000,
+            .tv_nsec = (deadline % 1000000) * 1000
+        }
+    };
+    if (timerfd_settime(ws->timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        Panic("timerfd_settime error: %s\n", strerror(errno));
+    }
+    ws->deadline = deadline;
+}
+
+/*
+ * wait until the deadline or the source is readable, returns the number
+ * of ready descriptors and sets source_ready if the source is readable.
+ */
+static int wakeup_wait(wakeup_set *ws, long deadline, int *source_ready)
+{
+    struct epoll_event evs[2];
+
+    wakeup_arm(ws, deadline);
+    int ret = epoll_wait(ws->epfd, evs, array_size(evs), -1);
+
+    *source_ready = 0;
+    for (int i = 0; i < ret; i++) {
+        if (evs[i].data.u32 == wakeup_source) {
+            *source_ready = 1;
+        } else {
+            uint64_t expirations;
+            if (read(ws->timerfd, &expirations, sizeof(expirations)) < 0 &&
+                errno != EAGAIN) {
+                Panic("timerfd read error: %s\n", strerror(errno));
+            }
+            ws->deadline = 0;
+        }
+    }
+    return ret;
+}
+
+typedef enum { frame_ready, event_ready } wait_status;
+
+static wakeup_set event_wakeup;
+
+/*
+ * wait until the earliest frame deadline of all windows or next event
+ */
+wait_status wait_frame_or_event(Display *d)
+{
+    int source_ready;
+
+    for (;;) {
+        current_time = get_time_microseconds();
+
+        app_window *win = window_next();
+        long deadline = win ? win->next_draw_time : 0;
+        long timeout = win ? deadline - current_time : -1;
+        if (win && timeout <= 0) return frame_ready;
+
+        Trace("[%lu/%ld] Poll: timeout=%ld\n",
+            frame_number, current_time, timeout);
+        TraceRecord(current_time, FRAME_TRACE_NO_WINDOW, trace_poll, 0, timeout, 0, 0);
+
+        int ret = wakeup_wait(&event_wakeup, deadline, &source_ready);
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret < 0) {
+            Panic("poll error: %s\n", strerror(errno));
+        } else if (source_ready && XEventsQueued(d, QueuedAfterReading) > 0) {
+            /* we can't allow XNextEvent to block so we must always check descriptor
+            * readiness then prime the in-memory queue if returning 'event_ready' */
+            return event_ready;
+        }
+    }
+}
+
+enum { RENDER_QUEUE_SIZE = 1024 };
+
+static int use_render_thread;
+static spsc_queue render_queue;
+static int render_eventfd = -1;
+
+static void handle_configure(Display *d, app_window *win, render_msg *m)
+{
+    win->width = m->configure.width;
+    win->height = m->configure.height;
+
+    win->configure_sync_serial = m->configure.sync_serial;
+    win->configure_extended_sync = m->configure.extended_sync;
+    sync_counter(d, win->extended_counter, win->current_sync_serial);
+    window_wake(win);
+}
+
+static void handle_expose(Display *d, app_window *win, render_msg *m)
+{
+    /* an automatic rate is already a sustainable divisor of the refresh
+     * rate, and capping it to the measured rate would only add judder */
+    if (use_auto_rate) {
+        submit_frame(d, win, frame_urgent, window_auto_rate(win));
+        return;
+    }
+
+    /* cap frame rate of expose frames to measured frame rate. the median
+     * is used so that a single long frame does not skew the cap, and the
+     * GPU frame time bounds it when the GPU is the bottleneck. */
+    long frame_time_p50 = timing_series_median(&win->frame_time_buffer);
+    long gpu_time_p50 = timing_series_median(&win->gpu_time_buffer);
+    if (gpu_time_p50 > frame_time_p50) frame_time_p50 = gpu_time_p50;
+    float measured_frame_rate = 1e6f / frame_time_p50;
+    float cap_frame_rate =
+        frame_time_p50 > 0 && frame_rate > measured_frame_rate ?
+        measured_frame_rate : frame_rate;
+
+    submit_frame(d, win, frame_urgent, cap_frame_rate);
+}
+
+static void handle_frame_drawn(Display *d, app_window *win, render_msg *m)
+{
+    if (m->drawn.sync_serial > win->drawn_sync_serial) {
+        win->drawn_sync_serial = m->drawn.sync_serial;
+    }
+    win->frame_drawn_serial = m->drawn.sync_serial;
+    win->frame_drawn_time = m->drawn.drawn_time;
+
+    /* compositor latency from frame start to frame drawn */
+    inflight_frame *f = inflight_find(win, m->drawn.sync_serial);
+    if (f && m->drawn.drawn_time > f->submit_time) {
+        timing_series_add(&win->compositor_latency_buffer,
+            m->drawn.drawn_time - f->submit_time);
+    }
+}
+
+static void handle_input(Display *d, app_window *win, render_msg *m)
+{
+    if (win->input_time == 0 || m->input.input_time < win->input_time) {
+        win->input_time = m->input.input_time;
+    }
+    window_wake(win);
+}
+
+static void handle_window_state(Display *d, app_window *win, render_msg *m)
+{
+    switch (m->type) {
+    case msg_visibility: win->obscured = m->state.value; break;
+    case msg_map: win->unmapped = !m->state.value; break;
+    case msg_focus: win->unfocused = !m->state.value; break;
+    default: break;
+    }
+
+    /* the compositor does not report frames of an unmapped window, so
+     * inflight frames are retired rather than waiting on their timings */
+    if (win->unmapped && win->timing_sync_serial < win->current_sync_serial) {
+        win->timing_sync_serial = win->current_sync_serial;
+        inflight_retire(win);
+        frame_resume(win);
+    }
+
+    /* reschedule from the last frame at the new cadence */
+    if (window_idle(win)) {
+        win->frame_idle = 1;
+    } else if (win->frame_idle) {
+        window_wake(win);
+    } else if (!win->frame_deferred) {
+        schedule_frame(win, window_frame_rate(win, frame_rate));
+    }
+
+    Trace("[%lu/%ld] Idle: window=%u idle=%d unmapped=%d obscured=%d "
+        "unfocused=%d\n", frame_number, current_time, win->index,
+        win->frame_idle, win->unmapped, win->obscured, win->unfocused);
+}
+
+/*
+ * input to display latency
+ *
+ * each frame records the earliest input received before it started. when
+ * a frame is displayed, at its drawn time plus presentation offset, the
+ * latency is recorded for input carried by it or by any earlier frame that
+ * was superseded without timings of its own.
+ */
+static void input_latency_update(app_window *win, ulong sync_serial,
+    long presentation_offset)
+{
+    if (sync_serial != win->frame_drawn_serial || !win->frame_drawn_time) {
+        return;
+    }
+    long display_time = win->frame_drawn_time + presentation_offset;
+
+    for (uint i = win->inflight_tail; i != win->inflight_head; i++) {
+        inflight_frame *f = &win->inflight_ring[i % MAX_INFLIGHT_FRAMES];
+        if (f->sync_serial > sync_serial || !f->input_time) continue;
+        if (display_time > f->input_time) {
+            timing_series_add(&win->input_latency_buffer,
+                display_time - f->input_time);
+            Trace("[%lu/%ld] Input: sync_serial=%lu latency=%ld "
+                "latency_p50_time=%ld latency_p95_time=%ld\n",
+                frame_number, current_time, f->sync_serial,
+                display_time - f->input_time,
+                timing_series_median(&win->input_latency_buffer),
+                timing_series_percentile(&win->input_latency_buffer, 95));
+        }
+        f->input_time = 0;
+    }
+}
+
+static void handle_frame_timings(Display *d, app_window *win, render_msg *m)
+{
+    if (m->timings.sync_serial > win->timing_sync_serial) {
+        win->timing_sync_serial = m->timings.sync_serial;
+    }
+    vblank_update(win, m->timings.sync_serial, m->timings.presentation_offset,
+        m->timings.refresh_interval);
+    input_latency_update(win, m->timings.sync_serial,
+        m->timings.presentation_offset);
+    frame_resume(win);
+}
+
+/*
+ * update vblank phase and period from the UST and MSC of a completion
+ *
+ * UST is CLOCK_MONOTONIC microseconds on Linux, so like the compositor
+ * timings the vblank time is on our own clock.
+ */
+static void present_vblank_update(app_window *win, uint64_t ust, uint64_t msc)
+{
+    if (win->present_last_msc > 0 && msc > win->present_last_msc &&
+        ust > win->present_last_ust) {
+        long interval = (long)((ust - win->present_last_ust) /
+            (msc - win->present_last_msc));
+        win->vblank_interval = win->vblank_interval == 0 ? interval :
+            (win->vblank_interval * 7 + interval) / 8;
+    }
+    win->present_last_ust = ust;
+    win->present_last_msc = msc;
+    win->vblank_time = (long)ust;
+}
+
+static void handle_present_complete(Display *d, app_window *win, render_msg *m)
+{
+    win->present_complete_count++;
+    present_vblank_update(win, m->present.ust, m->present.msc);
+
+    if (m->present.kind == PresentCompleteKindPixmap) {
+        win->have_present_pixmap = 1;
+        if (win->present_pending_head != win->present_pending_tail) {
+            ulong sync_serial = win->present_pending[
+                win->present_pending_tail++ % PRESENT_PENDING_FRAMES];
+
+            /* the frame was drawn and presented at the completion vblank */
+            render_msg drawn = { .type = msg_frame_drawn };
+            drawn.drawn.sync_serial = sync_serial;
+            drawn.drawn.drawn_time = (long)m->present.ust;
+            handle_frame_drawn(d, win, &drawn);
+            input_latency_update(win, sync_serial, 0);
+
+            if (sync_serial > win->timing_sync_serial) {
+                win->timing_sync_serial = sync_serial;
+            }
+        }
+    }
+    frame_resume(win);
+}
+
+static void handle_present_idle(Display *d, app_window *win, render_msg *m)
+{
+    win->present_idle_count++;
+    Trace("[%lu/%ld] Present: idle buffers_busy=%ld\n",
+        frame_number, get_time_microseconds(),
+        (long)(win->present_complete_count - win->present_idle_count));
+}
+
+static void handle_msg(Display *d, render_msg *m)
+{
+    app_window *win = &windows[m->window];
+
+    /* compositor timings are ignored when Present is the timing source */
+    int ewmh = timing_source == timing_ewmh;
+
+    switch (m->type) {
+    case msg_configure: handle_configure(d, win, m); break;
+    case msg_expose: handle_expose(d, win, m); break;
+    case msg_frame_drawn: if (ewmh) handle_frame_drawn(d, win, m); break;
+    case msg_frame_timings: if (ewmh) handle_frame_timings(d, win, m); break;
+    case msg_present_complete: handle_present_complete(d, win, m); break;
+    case msg_present_idle: handle_present_idle(d, win, m); break;
+    case msg_input: handle_input(d, win, m); break;
+    case msg_visibility:
+    case msg_map:
+    case msg_focus: handle_window_state(d, win, m); break;
+    }
+}
+
+static void post_msg(Display *d, app_window *win, render_msg *m)
+{
+    m->window = win->index;
+
+    if (!use_render_thread) {
+        handle_msg(d, m);
+        return;
+    }
+
+    /* the render thread drains the queue between frames */
+    while (!spsc_queue_push(&render_queue, m)) {
+        sched_yield();
+    }
+
+    uint64_t one = 1;
+    if (write(render_eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        Panic("eventfd write error: %s\n", strerror(errno));
+    }
+}
+
+/*
+ * expose and configure coalescing
+ *
+ * during interactive resize the queue can hold several ConfigureNotify and
+ * Expose events that would each produce an urgent frame at a size that is
+ * already stale. the drain loop folds them into one configure at the latest
+ * size and one expose that are posted when the queue is empty. a configure
+ * that is superseded passes its sync serial forward, so that the counter
+ * written after the frame covers every serial that was skipped. input
+ * events are folded into one message with the time of the earliest, which
+ * is all the input latency measurement needs, so pointer motion does not
+ * flood the render queue.
+ */
+
+enum { COALESCE_MAX_READS = 4 };
+
+static void coalesce_configure(app_window *win, render_msg *m)
+{
+    if (win->pending_configure) {
+        if (m->configure.sync_serial == 0) {
+            render_msg *pending = &win->pending_configure_msg;
+            m->configure.sync_serial = pending->configure.sync_serial;
+            m->configure.extended_sync = pending->configure.extended_sync;
+        }
+        win->coalesced_configures++;
+    }
+    win->pending_configure_msg = *m;
+    win->pending_configure = 1;
+}
+
+static void coalesce_expose(app_window *win)
+{
+    if (win->pending_expose) {
+        win->coalesced_exposes++;
+    }
+    win->pending_expose = 1;
+}
+
+static void coalesce_input(app_window *win, long input_time)
+{
+    if (!win->pending_input) {
+        win->pending_input_time = input_time;
+    }
+    win->pending_input = 1;
+}
+
+static void coalesce_flush(Display *d, app_window *win)
+{
+    render_msg m;
+
+    if (win->pending_input) {
+        win->pending_input = 0;
+        m.type = msg_input;
+        m.input.input_time = win->pending_input_time;
+        post_msg(d, win, &m);
+    }
+    if (win->pending_configure) {
+        win->pending_configure = 0;
+        post_msg(d, win, &win->pending_configure_msg);
+    }
+    if (win->pending_expose) {
+        win->pending_expose = 0;
+        m.type = msg_expose;
+        post_msg(d, win, &m);
+    }
+}
+
+/*
+ * the server timestamps input in milliseconds, which on Xorg is
+ * CLOCK_MONOTONIC, so a timestamp that is plausible on our clock is used
+ * to include the delivery delay. otherwise the receive time is used.
+ */
+static long input_event_time(Time server_time, long event_time)
+{
+    long t = (long)server_time * 1000;
+    return t <= event_time && event_time - t < 1000000 ? t : event_time;
+}
+
+/*
+ * decode an X11 event received at event_time
+ */
+static void process_xevent(Display *d, XEvent *e, long event_time)
+{
+    render_msg m;
+    long *l;
+
+    /* generic events carry their window in the decoded event data */
+    app_window *win = e->type == GenericEvent ? NULL :
+        window_find(e->xany.window);
+    TraceRecord(event_time, win ? win->index : FRAME_TRACE_NO_WINDOW,
+        trace_event, e->type, e->xany.serial, 0, 0);
+
+    switch (e->type)
+    {
+        case Expose:
+        {
+            Trace("[%lu/%ld] Event: Expose serial=%lu count=%d\n",
+                frame_number, event_time, e->xexpose.serial, e->xexpose.count);
+
+            /* count is the number of Expose events that follow */
+            if (win && e->xexpose.count == 0) {
+                coalesce_expose(win);
+            }
+            break;
+        }
+        case ConfigureNotify:
+        {
+            if (!win) break;
+
+            m.type = msg_configure;
+            m.configure.width = e->xconfigure.width;
+            m.configure.height = e->xconfigure.height;
+            m.configure.sync_serial = win->request_sync_serial;
+            m.configure.extended_sync = win->request_extended_sync;
+            win->request_sync_serial = 0;
+            win->request_extended_sync = 0;
+
+            Trace("[%lu/%ld] Event: ConfigureNotify serial=%lu size=%dx%d "
+                "request_sync_serial=%lu extended_sync=%d\n",
+                frame_number, event_time, e->xconfigure.serial,
+                m.configure.width, m.configure.height,
+                m.configure.sync_serial, m.configure.extended_sync);
+            TraceRecord(event_time, win->index, trace_configure, 0, m.configure.width,
+                m.configure.height, m.configure.sync_serial);
+
+            coalesce_configure(win, &m);
+            break;
+        }
+        case ClientMessage:
+        {
+            if (!win) break;
+
+            l = e->xclient.data.l;
+            if (e->xclient.message_type == WM_PROTOCOLS && l[0] == _NET_WM_PING)
+            {
+                ulong timestamp = l[1], window = l[2];
+
+                e->xclient.window = DefaultRootWindow(d);
+                XSendEvent(d, DefaultRootWindow(d), False,
+                    SubstructureRedirectMask | SubstructureNotifyMask, e);
+
+                Trace("[%lu/%ld] Event: ClientMessage: _NET_WM_PING "
+                    "serial=%lu timestamp=%lu window=%lu\n",
+                    frame_number, event_time, e->xclient.serial,
+                    timestamp, window);
+            }
+            else if (e->xclient.message_type == WM_PROTOCOLS && l[0] == _NET_WM_SYNC_REQUEST)
+            {
+                win->request_sync_serial = l[2] + ((long)l[3] << 32);
+                win->request_extended_sync = l[4] != 0;
+
+                Trace("[%lu/%ld] Event: ClientMessage: _NET_WM_SYNC_REQUEST "
+                    "serial=%lu sync_serial=%lu extended_sync=%d\n",
+                    frame_number, event_time, e->xclient.serial,
+                    win->request_sync_serial, win->request_extended_sync);
+                TraceRecord(event_time, win->index, trace_sync_request, 0,
+                    win->request_sync_serial, win->request_extended_sync, 0);
+            }
+            else if (e->xclient.message_type == _NET_WM_FRAME_DRAWN)
+            {
+                m.type = msg_frame_drawn;
+                m.drawn.drawn_time =  ((long)l[3] << 32) | l[2];
+                m.drawn.sync_serial = ((long)l[1] << 32) | l[0];
+
+                Trace("[%lu/%ld] Event: ClientMessage: _NET_WM_FRAME_DRAWN "
+                    "serial=%lu sync_serial=%lu drawn_time=%ld\n",
+                    frame_number, event_time, e->xclient.serial,
+                    m.drawn.sync_serial, m.drawn.drawn_time);
+                TraceRecord(event_time, win->index, trace_frame_drawn, 0,
+                    m.drawn.sync_serial, m.drawn.drawn_time, 0);
+
+                post_msg(d, win, &m);
+            }
+            else if (e->xclient.message_type == _NET_WM_FRAME_TIMINGS)
+            {
+                m.type = msg_frame_timings;
+                m.timings.presentation_offset = l[2];
+                m.timings.refresh_interval = l[3];
+                m.timings.frame_delay = l[4];
+                m.timings.sync_serial = ((long)l[1] << 32) | l[0];
+
+                Trace("[%lu/%ld] Event: ClientMessage: _NET_WM_FRAME_TIMINGS "
+                    "serial=%lu sync_serial=%lu presentation_offset=%u "
+                    "refresh_interval=%u frame_delay=%u\n",
+                    frame_number, event_time, e->xclient.serial,
+                    m.timings.sync_serial, m.timings.presentation_offset,
+                    m.timings.refresh_interval, m.timings.frame_delay);
+                TraceRecord(event_time, win->index, trace_frame_timings, 0,
+                    m.timings.sync_serial, m.timings.presentation_offset,
+                    (uint32_t)m.timings.refresh_interval |
+                    ((uint64_t)m.timings.frame_delay << 32));
+
+                post_msg(d, win, &m);
+            }
+            break;
+        }
+        case GenericEvent:
+        {
+            x11_present_event pe;
+            if (!have_present_extension ||
+                !x11_present_event_data(d, &present, &e->xcookie, &pe) ||
+                !(win = window_find(pe.window))) {
+                break;
+            }
+            if (pe.evtype == PresentCompleteNotify) {
+                m.type = msg_present_complete;
+                m.present.ust = pe.ust;
+                m.present.msc = pe.msc;
+                m.present.kind = pe.kind;
+                m.present.mode = pe.mode;
+
+                Trace("[%lu/%ld] Event: PresentCompleteNotify serial=%u "
+                    "kind=%s mode=%s ust=%lu msc=%lu\n",
+                    frame_number, event_time, pe.serial,
+                    pe.kind == PresentCompleteKindPixmap ? "pixmap" : "msc",
+                    pe.mode < array_size(x11_present_mode_names) ?
+                        x11_present_mode_names[pe.mode] : "unknown",
+                    (ulong)pe.ust, (ulong)pe.msc);
+                TraceRecord(event_time, win->index, trace_present_complete, pe.kind,
+                    pe.ust, pe.msc, pe.mode);
+
+                post_msg(d, win, &m);
+            } else if (pe.evtype == PresentIdleNotify) {
+                m.type = msg_present_idle;
+
+                Trace("[%lu/%ld] Event: PresentIdleNotify serial=%u "
+                    "pixmap=%lu\n", frame_number, event_time, pe.serial,
+                    pe.pixmap);
+
+                post_msg(d, win, &m);
+            }
+            break;
+        }
+        case KeyPress:
+        case ButtonPress:
+        case MotionNotify:
+        {
+            if (!win) break;
+
+            Time server_time = e->type == KeyPress ? e->xkey.time :
+                e->type == ButtonPress ? e->xbutton.time : e->xmotion.time;
+            long input_time = input_event_time(server_time, event_time);
+
+            Trace("[%lu/%ld] Event: %s serial=%lu input_time=%ld\n",
+                frame_number, event_time, xevent_names[e->type],
+                e->xany.serial, input_time);
+
+            coalesce_input(win, input_time);
+            break;
+        }
+        case VisibilityNotify:
+        {
+            if (!win) break;
+
+            Trace("[%lu/%ld] Event: VisibilityNotify state=%d\n",
+                frame_number, event_time, e->xvisibility.state);
+
+            m.type = msg_visibility;
+            m.state.value = e->xvisibility.state == VisibilityFullyObscured;
+            post_msg(d, win, &m);
+            break;
+        }
+        case MapNotify:
+        case UnmapNotify:
+        {
+            if (!win) break;
+
+            Trace("[%lu/%ld] Event: %s\n",
+                frame_number, event_time, xevent_names[e->type]);
+
+            m.type = msg_map;
+            m.state.value = e->type == MapNotify;
+            post_msg(d, win, &m);
+            break;
+        }
+        case FocusIn:
+        case FocusOut:
+        {
+            if (!win) break;
+
+            Trace("[%lu/%ld] Event: %s mode=%d detail=%d\n",
+                frame_number, event_time, xevent_names[e->type],
+                e->xfocus.mode, e->xfocus.detail);
+
+            /* focus moves temporarily to the grabbing client during grabs */
+            if (e->xfocus.mode == NotifyGrab || e->xfocus.mode == NotifyUngrab ||
+                e->xfocus.detail == NotifyPointer) {
+                break;
+            }
+            m.type = msg_focus;
+            m.state.value = e->type == FocusIn;
+            post_msg(d, win, &m);
+            break;
+        }
+        case PropertyNotify:
+        {
+            Trace("[%lu/%ld] Event: PropertyNotify: %s\n",
+                frame_number, event_time, atom_name(d, e->xproperty.atom));
+            break;
+        }
+        default:
+        {
+            if (e->type < array_size(xevent_names)) {
+                Trace("[%lu/%ld] Event: %s\n",
+                    frame_number, event_time, xevent_names[e->type]);
+            } else {
+                Trace("[%lu/%ld] Event: (unknown-type=%d)\n",
+                    frame_number, event_time, e->type);
+            }
+            break;
+        }
+    }
+}
+
+/*
+ * process X11 event
+ */
+void process_event(Display *d)
+{
+    XEvent e;
+
+    XNextEvent(d, &e);
+    process_xevent(d, &e, get_time_microseconds());
 }
 
-static int check_wm_supported(Atom atom)
+/*
+ * process X11 event queue without blocking
+ *
+ * after draining buffered events, events already received by the socket
+ * are read without blocking so that they can be coalesced, then pending
+ * configure and expose events are posted.
+ */
+static int coalesce_pending()
 {
-    if (!have_net_supported) return 0;
-
-    for (int i = 0; i < num_supported_atoms; i++) {
-        if (supported_atoms[i] == atom)return 1;
+    for (uint i = 0; i < num_windows; i++) {
+        if (windows[i].pending_configure || windows[i].pending_expose ||
+            windows[i].pending_input) {
+            return 1;
+        }
     }
+    return 0;
 }
 
-static void update_wm_protocols(Display *d, Window w)
+static void process_events(Display *d)
 {
-    Atom protocols[] = { _NET_WM_PING, _NET_WM_SYNC_REQUEST };
+    int reads = 0;
 
-    XSetWMProtocols(d, w, protocols, array_size(protocols));
+    do {
+        while (XEventsQueued(d, QueuedAlready) > 0) {
+            process_event(d);
+        }
+    } while (++reads < COALESCE_MAX_READS && coalesce_pending() &&
+             XEventsQueued(d, QueuedAfterReading) > 0);
+
+    for (uint i = 0; i < num_windows; i++) {
+        app_window *win = &windows[i];
+        if (win->pending_configure || win->pending_expose) {
+            Trace("[%lu/%ld] Coalesce: window=%u configure=%d expose=%d "
+                "coalesced_configures=%lu coalesced_exposes=%lu\n",
+                frame_number, get_time_microseconds(), win->index,
+                win->pending_configure, win->pending_expose,
+                win->coalesced_configures, win->coalesced_exposes);
+        }
+        coalesce_flush(d, win);
+    }
 }
 
-static void update_wm_hints(Display *d, Window w)
-{
-    XWMHints wm_hints;
+/*
+ * render thread
+ */
 
-    wm_hints.flags = StateHint | InputHint;
-    wm_hints.input = True;
-    wm_hints.initial_state = NormalState;
+typedef struct {
+    Display *d;
+} render_thread_args;
 
-    XSetWMHints(d, w, &wm_hints);
-}
+/*
+ * wait for next frame or render message
+ */
+static wakeup_set message_wakeup;
 
-static void sync_init(Display *d, Window w)
+static wait_status wait_frame_or_message()
 {
-    XSyncValue value;
-    XID counters[2];
-    int major, minor;
+    int source_ready;
 
-    have_xsync_extension =
-        (XSyncQueryExtension(d, &xsync_event_base, &xsync_error_base) &&
-         XSyncInitialize(d, &major, &minor));
+    for (;;) {
+        current_time = get_time_microseconds();
 
-    if (!have_xsync_extension) return;
+        if (spsc_queue_count(&render_queue) > 0) return event_ready;
 
-    XSyncIntToValue (&value, 0);
-    update_counter = XSyncCreateCounter(d, value);
-    extended_counter = XSyncCreateCounter(d, value);
+        app_window *win = window_next();
+        long deadline = win ? win->next_draw_time : 0;
+        long timeout = win ? deadline - current_time : -1;
+        if (win && timeout <= 0) return frame_ready;
 
-    counters[0] = update_counter;
-    counters[1] = extended_counter;
+        Trace("[%lu/%ld] Poll: timeout=%ld\n",
+            frame_number, current_time, timeout);
+        TraceRecord(current_time, FRAME_TRACE_NO_WINDOW, trace_poll, 0, timeout, 0, 0);
 
-    XChangeProperty(d, w, _NET_WM_SYNC_REQUEST_COUNTER, XA_CARDINAL,
-           32, PropModeReplace, (unsigned char*)counters, 2);
+        int ret = wakeup_wait(&message_wakeup, deadline, &source_ready);
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret < 0) {
+            Panic("poll error: %s\n", strerror(errno));
+        } else if (source_ready) {
+            uint64_t value;
+            if (read(render_eventfd, &value, sizeof(value)) < 0 &&
+                errno != EAGAIN) {
+                Panic("eventfd read error: %s\n", strerror(errno));
+            }
+        }
+    }
 }
 
-static void sync_counter(Display *d, XSyncCounter counter, ulong value)
+static void* render_thread_main(void *arg)
 {
-    XSyncValue sync_value;
-
-    if (!have_xsync_extension) return;
+    render_thread_args *args = (render_thread_args*)arg;
+    Display *d = args->d;
+    render_msg m;
 
-    XSyncIntsToValue(&sync_value, value & 0xFFFFFFFF, value >> 32);
-    XSyncSetCounter(d, counter, sync_value);
-}
+    window_make_current(d, &windows[0]);
 
-typedef enum { frame_normal, frame_urgent } frame_disposition;
+    init();
+    window_start_frames();
 
-/*
- * inform the compositor that we are starting to draw a frame
- */
-static void begin_frame(Display *d, Window w, frame_disposition disposition)
-{
-    /* extended synchronization in response to _NET_WM_SYNC_REQUEST */
-    if (configure_sync_serial != 0 && configure_extended_sync)
+    for (;;)
     {
-        current_sync_serial = configure_sync_serial;
-        configure_sync_serial = 0;
-    }
-    /* advance frame to next multiple of 4 */
-    if ((current_sync_serial & 3) != 0) {
-        current_sync_serial = (current_sync_serial + 3) & ~3;
-    }
-    /* advance frame to odd value, 1 = normal, 3 = urgent */
-    inflight_sync_serial = current_sync_serial + 4;
-    current_sync_serial += (disposition == frame_urgent ? 3 : 1);
-    sync_counter(d, extended_counter, current_sync_serial);
-}
+        switch (wait_frame_or_message()) {
+        case event_ready: break;
+        case frame_ready:
+            submit_frame(d, window_next(), frame_normal, frame_rate);
+        }
 
-/*
- * inform the compositor that we have finished drawing a frame
- */
-static void end_frame(Display *d, Window w)
-{
-    /* extended synchronization */
-    if ((current_sync_serial & 3) == 1) {
-        current_sync_serial += 3;
-        sync_counter(d, extended_counter, current_sync_serial);
-    } else if ((current_sync_serial & 3) == 3) {
-        current_sync_serial += 1;
-        sync_counter(d, extended_counter, current_sync_serial);
+        while (spsc_queue_pop(&render_queue, &m)) {
+            handle_msg(d, &m);
+        }
     }
 
-    /* basic synchronization */
-    if (configure_sync_serial != 0 && configure_extended_sync) {
-        sync_counter(d, update_counter, configure_sync_serial);
-        configure_sync_serial = 0;
-        configure_extended_sync = 0;
-    }
+    return NULL;
 }
 
 /*
- * submit frame for rendering
+ * wait for events without a frame deadline
  */
-static void submit_frame(Display *d, Window w, frame_disposition disposition,
-    float target_frame_rate)
+static void wait_event(Display *d)
 {
-    current_time = get_time_microseconds();
-
-    /* tearing may result if frames are submitted before receiving timings
-     * for inflight frames submitted in response to synchronization requests */
-    if (timing_sync_serial > 0 && timing_sync_serial < inflight_sync_serial)
-    {
-        XSync(d, False);
-        next_draw_time = current_time + 2000;
-        Trace("[%lu/%ld] Delay: disposition=%s timing_sync_serial=%lu "
-            "inflight_sync_serial=%lu\n", frame_number, current_time,
-            disposition == frame_urgent ? "urgent" : "normal",
-            timing_sync_serial, inflight_sync_serial);
-        return;
-    }
+    int source_ready;
 
-    Trace("[%lu/%ld] FrameBegin: delta_time=%ld sync_serial=%lu "
-        "frame_avg_time=%ld render_avg_time=%ld\n",
-        frame_number, current_time, delta_time, current_sync_serial,
-        circular_buffer_average(&frame_time_buffer),
-        circular_buffer_average(&render_time_buffer));
+    for (;;) {
+        int ret = wakeup_wait(&event_wakeup, 0, &source_ready);
 
-    if (last_draw_time) {
-        delta_time = current_time - last_draw_time;
-        circular_buffer_add(&frame_time_buffer, delta_time);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        } else if (ret < 0) {
+            Panic("poll error: %s\n", strerror(errno));
+        } else if (source_ready && XEventsQueued(d, QueuedAfterReading) > 0) {
+            return;
+        }
     }
-    last_draw_time = current_time;
-    next_draw_time = current_time + (long)(1e6f / target_frame_rate);
-
-    frame_number++;
-
-    draw_frame();
-    begin_frame(d, w, frame_normal);
-    glXSwapBuffers(d, w);
-    glXWaitX();
-    end_frame(d, w);
-
-    current_time = get_time_microseconds();
-    render_time = current_time - last_draw_time;
-    circular_buffer_add(&render_time_buffer, render_time);
-
-    Trace("[%lu/%ld] FrameEnd: delta_time=%ld sync_serial=%lu "
-        "frame_avg_time=%ld render_avg_time=%ld\n",
-        frame_number, current_time, delta_time, current_sync_serial,
-        circular_buffer_average(&frame_time_buffer),
-        circular_buffer_average(&render_time_buffer));
 }
 
 /*
- * poll X11 event queue with timeout
+ * headless benchmark
+ *
+ * windows are pbuffers so no window manager or visible desktop is needed
+ * and the benchmark runs on Xvfb. the loop is the event loop without a
+ * render thread, with the scripted compositor run before each wait. the
+ * result is printed as one JSON object with frame interval and render
+ * time percentiles over the whole run.
  */
-static int poll_event_queue(Display *d, long timeout)
+static GLXFBConfig find_glx_pbuffer_config(Display *d, int s)
 {
-    struct pollfd pfds[1] = {
-        { .fd = ConnectionNumber(d), .events = POLLIN }
-    };
-    struct timespec pts = {
-        .tv_sec = timeout / 1000000,
-        .tv_nsec = (timeout % 1000000) * 1000
+    int attribs[] = {
+        GLX_DRAWABLE_TYPE, GLX_PBUFFER_BIT,
+        GLX_RENDER_TYPE, GLX_RGBA_BIT,
+        GLX_DOUBLEBUFFER, True,
+        GLX_RED_SIZE, 8,
+        GLX_GREEN_SIZE, 8,
+        GLX_BLUE_SIZE, 8,
+        GLX_ALPHA_SIZE, 8,
+        GLX_DEPTH_SIZE, 16,
+        None
     };
+    GLXFBConfig *configs, config = NULL;
+    int count;
 
-    return ppoll(pfds, array_size(pfds), &pts, NULL);
+    configs = glXChooseFBConfig(d, s, attribs, &count);
+    if (configs && count > 0) {
+        config = configs[0];
+    }
+    if (configs) XFree(configs);
+    return config;
 }
 
-typedef enum { frame_ready, event_ready } wait_status;
+static int compare_long(const void *a, const void *b)
+{
+    long x = *(const long*)a, y = *(const long*)b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
 
 /*
- * wait for next frame
+ * nearest rank percentile of sorted samples
  */
-
-wait_status wait_frame_or_event(Display *d, Window w)
+static long sample_percentile(long *arr, size_t count, int p)
 {
-    for (;;) {
-        current_time = get_time_microseconds();
-
-        long timeout = next_draw_time - current_time;
-        if (timeout <= 0) return frame_ready;
-
-        Trace("[%lu/%ld] Poll: timeout=%ld\n",
-            frame_number, current_time, timeout);
+    return count ? arr[(p * count + 99) / 100 - 1] : 0;
+}
 
-        int ret = poll_event_queue(d, timeout);
+static void bench_report(long elapsed)
+{
+    size_t n = script_frame_count < bench_frames ? script_frame_count :
+        bench_frames;
+    ulong coalesced_configures = 0, coalesced_exposes = 0;
 
-        if (ret < 0 && errno == EINTR) {
-            continue;
-        } else if (ret < 0) {
-            Panic("poll error: %s\n", strerror(errno));
-        } else if (ret == 0) {
-            return frame_ready;
-        } else if (ret == 1 && XEventsQueued(d, QueuedAfterReading) > 0) {
-            /* we can't allow XNextEvent to block so we must always check descriptor
-            * readiness then prime the in-memory queue if returning 'event_ready' */
-            return event_ready;
-        }
+    for (uint i = 0; i < num_windows; i++) {
+        coalesced_configures += windows[i].coalesced_configures;
+        coalesced_exposes += windows[i].coalesced_exposes;
     }
+
+    /* the first frame of each window has no interval */
+    qsort(script_frame_times, n, sizeof(long), compare_long);
+    qsort(script_render_times, n, sizeof(long), compare_long);
+    long *frame_times = script_frame_times + num_windows;
+    size_t frame_count = n > num_windows ? n - num_windows : 0;
+
+    printf("{\"name\":\"bench\",\"frames\":%zu,\"windows\":%u,"
+        "\"time_us\":%ld,\"frames_per_sec\":%.2f,"
+        "\"frame_p50_us\":%ld,\"frame_p95_us\":%ld,\"frame_p99_us\":%ld,"
+        "\"frame_max_us\":%ld,\"render_p50_us\":%ld,\"render_p99_us\":%ld,"
+        "\"sync_requests\":%lu,\"coalesced_configures\":%lu,"
+        "\"coalesced_exposes\":%lu,\"dropped\":%lu,\"late\":%lu,"
+        "\"violations\":%lu}\n",
+        n, num_windows, elapsed, elapsed > 0 ? n * 1e6 / elapsed : 0.0,
+        sample_percentile(frame_times, frame_count, 50),
+        sample_percentile(frame_times, frame_count, 95),
+        sample_percentile(frame_times, frame_count, 99),
+        frame_count ? frame_times[frame_count - 1] : 0,
+        sample_percentile(script_render_times, n, 50),
+        sample_percentile(script_render_times, n, 99),
+        script_sync_requests, coalesced_configures, coalesced_exposes,
+        script_dropped, script_late, script_violations);
+    fflush(stdout);
 }
 
-/*
- * process X11 event
- */
-void process_event(Display *d, Window w)
+void app_bench(char* argv0)
 {
-    XEvent e;
-    long *l;
+    Display *d;
+    int s, source_ready;
+    GLXFBConfig config;
 
-    XNextEvent(d, &e);
-    current_time = get_time_microseconds();
+    /* the script drives one event loop and only sends compositor timings,
+     * and pbuffers are never mapped, so the idle policy does not apply */
+    use_render_thread = 0;
+    timing_source = timing_ewmh;
+    use_idle_policy = 0;
 
-    switch (e.type)
-    {
-        case Expose:
-        {
-            Trace("[%lu/%ld] Event: Expose serial=%lu count=%d\n",
-                frame_number, current_time, e.xexpose.serial, e.xexpose.count);
+    d = XOpenDisplay(NULL);
+    if (d == NULL) {
+        Panic("Cannot open display\n");
+    }
 
-            /* cap frame rate of expose frames to measured frame rate. */
-            long frame_time_avg = circular_buffer_average(&frame_time_buffer);
-            float measured_frame_rate = 1e6f / frame_time_avg;
-            float cap_frame_rate =
-                frame_time_avg > 0 && frame_rate > measured_frame_rate ?
-                measured_frame_rate : frame_rate;
+    init_atoms(d);
 
-            submit_frame(d, w, frame_urgent, cap_frame_rate);
-            break;
-        }
-        case ConfigureNotify:
-        {
-            width = e.xconfigure.width;
-            height = e.xconfigure.height;
+    s = DefaultScreen(d);
+    config = find_glx_pbuffer_config(d, s);
+    if (!config) {
+        Panic("Cannot get glx pbuffer config\n");
+    }
 
-            configure_sync_serial = request_sync_serial;
-            configure_extended_sync = request_extended_sync;
-            request_sync_serial = 0;
-            request_extended_sync = 0;
-            sync_counter(d, extended_counter, current_sync_serial);
+    wakeup_init(&event_wakeup, ConnectionNumber(d));
 
-            Trace("[%lu/%ld] Event: ConfigureNotify serial=%lu size=%dx%d "
-                "current_sync_serial=%lu request_sync_serial=%lu extended_sync=%d\n",
-                frame_number, current_time, e.xconfigure.serial,
-                width, height, current_sync_serial, configure_sync_serial,
-                configure_extended_sync);
-            break;
+    if (use_frame_sync) {
+        sync_init(d);
+    }
+
+    int pbuffer_attribs[] = {
+        GLX_PBUFFER_WIDTH, width,
+        GLX_PBUFFER_HEIGHT, height,
+        None
+    };
+
+    /* counters are created as for windows, without the window property */
+    for (uint i = 0; i < num_windows; i++) {
+        app_window *win = &windows[i];
+        win->index = i;
+        win->width = width;
+        win->height = height;
+        win->render_scale = 1.0f;
+        win->w = glXCreatePbuffer(d, config, pbuffer_attribs);
+        if (have_xsync_extension) {
+            XSyncValue value;
+            XSyncIntToValue(&value, 0);
+            win->update_counter = XSyncCreateCounter(d, value);
+            win->extended_counter = XSyncCreateCounter(d, value);
         }
-        case ClientMessage:
-        {
-            l = e.xclient.data.l;
-            if (e.xclient.message_type == WM_PROTOCOLS && l[0] == _NET_WM_PING)
-            {
-                ulong timestamp = l[1], window = l[2];
+    }
 
-                e.xclient.window = DefaultRootWindow(d);
-                XSendEvent(d, DefaultRootWindow(d), False,
-                    SubstructureRedirectMask | SubstructureNotifyMask, &e);
+    render_context = glXCreateNewContext(d, config, GLX_RGBA_TYPE, NULL, True);
+    if (!render_context) {
+        Panic("Cannot create glx context\n");
+    }
 
-                Trace("[%lu/%ld] Event: ClientMessage: _NET_WM_PING "
-                    "serial=%lu timestamp=%lu window=%lu\n",
-                    frame_number, current_time, e.xclient.serial,
-                    timestamp, window);
-            }
-            else if (e.xclient.message_type == WM_PROTOCOLS && l[0] == _NET_WM_SYNC_REQUEST)
-            {
-                request_sync_serial = l[2] + ((long)l[3] << 32);
-                request_extended_sync = l[4] != 0;
+    Debug("Bench: frames=%lu windows=%u latency=%ld jitter=%ld storm=%u "
+        "xsync_extension=%d\n", bench_frames, num_windows, script_latency,
+        script_jitter, script_storm_interval, have_xsync_extension);
 
-                Trace("[%lu/%ld] Event: ClientMessage: _NET_WM_SYNC_REQUEST "
-                    "serial=%lu sync_serial=%lu extended_sync=%d\n",
-                    frame_number, current_time, e.xclient.serial,
-                    request_sync_serial, request_extended_sync);
-            }
-            else if (e.xclient.message_type == _NET_WM_FRAME_DRAWN)
-            {
-                long drawn_time =  ((long)l[3] << 32) | l[2];
-                ulong sync_serial = ((long)l[1] << 32) | l[0];
+    script_frame_times = (long*)calloc(bench_frames, sizeof(long));
+    script_render_times = (long*)calloc(bench_frames, sizeof(long));
+    srand(1);
 
-                if (sync_serial > drawn_sync_serial) {
-                    drawn_sync_serial = sync_serial;
-                }
+    window_make_current(d, &windows[0]);
 
-                Trace("[%lu/%ld] Event: ClientMessage: _NET_WM_FRAME_DRAWN "
-                    "serial=%lu sync_serial=%lu drawn_time=%ld\n",
-                    frame_number, current_time, e.xclient.serial,
-                    sync_serial, drawn_time);
-            }
-            else if (e.xclient.message_type == _NET_WM_FRAME_TIMINGS)
-            {
-                int presentation_offset = l[2];
-                int refresh_interval = l[3];
-                int frame_delay = l[4];
-                ulong sync_serial = ((long)l[1] << 32) | l[0];
+    init();
+    window_start_frames();
+    long start_time = current_time;
 
-                if (sync_serial > timing_sync_serial) {
-                    timing_sync_serial = sync_serial;
-                }
+    while (script_frame_count < bench_frames)
+    {
+        current_time = get_time_microseconds();
+        long script_time = script_compositor(d, current_time);
 
-                Trace("[%lu/%ld] Event: ClientMessage: _NET_WM_FRAME_TIMINGS "
-                    "serial=%lu sync_serial=%lu presentation_offset=%u "
-                    "refresh_interval=%u frame_delay=%u\n",
-                    frame_number, current_time, e.xclient.serial,
-                    sync_serial, presentation_offset,
-                    refresh_interval, frame_delay);
-            }
-            break;
+        if (XEventsQueued(d, QueuedAlready) > 0) {
+            process_events(d);
+            continue;
         }
-        case PropertyNotify:
-        {
-            Trace("[%lu/%ld] Event: PropertyNotify: %s\n",
-                frame_number, current_time, XGetAtomName(d, e.xproperty.atom));
-            break;
+
+        app_window *win = window_next();
+        if (win->next_draw_time <= current_time) {
+            submit_frame(d, win, frame_normal, frame_rate);
+            continue;
         }
-        default:
-        {
-            if (e.type < array_size(xevent_names)) {
-                Trace("[%lu/%ld] Event: %s\n",
-                    frame_number, current_time, xevent_names[e.type]);
-            } else {
-                Trace("[%lu/%ld] Event: (unknown-type=%d)\n",
-                    frame_number, current_time, e.type);
-            }
-            break;
+
+        long deadline = win->next_draw_time;
+        if (script_time && script_time < deadline) deadline = script_time;
+
+        int ret = wakeup_wait(&event_wakeup, deadline, &source_ready);
+        if (ret < 0 && errno != EINTR) {
+            Panic("poll error: %s\n", strerror(errno));
+        } else if (ret > 0 && source_ready) {
+            XEventsQueued(d, QueuedAfterReading);
         }
     }
+
+    glFinish();
+    bench_report(get_time_microseconds() - start_time);
+
+    free(script_frame_times);
+    free(script_render_times);
+    job_system_destroy(&jobs);
+    atom_cache_destroy();
+    glXMakeCurrent(d, None, NULL);
+    glXDestroyContext(d, render_context);
+    for (uint i = 0; i < num_windows; i++) {
+        glXDestroyPbuffer(d, windows[i].w);
+    }
+    XCloseDisplay(d);
 }
 
 /*
@@ -768,24 +3324,36 @@ void process_event(Display *d, Window w)
 
 void app_run(char* argv0)
 {
-    Display *d;
-    Window w;
+    Display *d, *rd;
     int s;
     XVisualInfo *visinfo;
-    GLXContext ctx;
+    pthread_t render_thread;
+    render_thread_args render_args;
+
+    if (use_render_thread) {
+        XInitThreads();
+    }
 
     d = XOpenDisplay(NULL);
     if (d == NULL) {
         Panic("Cannot open display\n");
     }
 
+    /* the render thread uses its own connection for GLX and counters */
+    rd = use_render_thread ? XOpenDisplay(NULL) : d;
+    if (rd == NULL) {
+        Panic("Cannot open render display\n");
+    }
+
+    init_atoms(d);
+
     s = DefaultScreen(d);
     visinfo = find_glx_visual(d, s);
     if (!visinfo) {
         Panic("Cannot get glx visual\n");
     }
 
-    init_atoms(d);
+    wakeup_init(&event_wakeup, ConnectionNumber(d));
 
     XSetWindowAttributes wa = { 0 };
     wa.colormap = XCreateColormap(d, RootWindow(d, s), visinfo->visual, AllocNone);
@@ -794,7 +3362,13 @@ void app_run(char* argv0)
                     ExposureMask | FocusChangeMask | VisibilityChangeMask |
                     EnterWindowMask | LeaveWindowMask | PropertyChangeMask;
 
-    w = XCreateWindow(d, RootWindow(d, s),
+    for (uint i = 0; i < num_windows; i++) {
+        app_window *win = &windows[i];
+        win->index = i;
+        win->width = width;
+        win->height = height;
+        win->render_scale = 1.0f;
+        win->w = XCreateWindow(d, RootWindow(d, s),
                       0, 0,   // Position
                       width, height,
                       0,      // Border width
@@ -803,51 +3377,110 @@ void app_run(char* argv0)
                       visinfo->visual,
                       CWBackPixel | CWBorderPixel | CWColormap | CWEventMask,
                       &wa);
+    }
 
-    ctx = glXCreateContext(d, visinfo, NULL, True);
+    /* one context is shared by all windows, which have the same visual */
+    render_context = glXCreateContext(rd, visinfo, NULL, True);
 
     if (use_frame_sync) {
-        sync_init(d, w);
+        sync_init(d);
         update_wm_supported(d, s);
-        update_wm_protocols(d, w);
-        update_wm_hints(d, w);
         have_wm_moveresize = check_wm_supported(_NET_WM_MOVERESIZE);
     }
+    if (timing_source == timing_present) {
+        present_init(d);
+    }
 
-    Debug("Capabilities: xsync_extension=%d net_supported=%d wm_moveresize=%d\n",
-        have_xsync_extension, have_net_supported, have_wm_moveresize);
+    Debug("Capabilities: xsync_extension=%d net_supported=%d wm_moveresize=%d "
+        "present_extension=%d\n", have_xsync_extension, have_net_supported,
+        have_wm_moveresize, have_present_extension);
 
-    XStoreName(d, w, basename(argv0));
-    XMapWindow(d, w);
-    glXMakeCurrent(d, w, ctx);
-    XSelectInput(d, w, wa.event_mask);
+    for (uint i = 0; i < num_windows; i++) {
+        app_window *win = &windows[i];
+        char name[64];
 
-    init();
+        if (use_frame_sync) {
+            sync_init_window(d, win);
+            update_wm_protocols(d, win->w);
+            update_wm_hints(d, win->w);
+        }
+        present_init_window(d, win);
 
-    /* draw first frame immediately */
-    next_draw_time = current_time = get_time_microseconds();
+        if (num_windows > 1) {
+            snprintf(name, sizeof(name), "%s [%u]", basename(argv0), i);
+        } else {
+            snprintf(name, sizeof(name), "%s", basename(argv0));
+        }
+        XStoreName(d, win->w, name);
+        XMapWindow(d, win->w);
+        XSelectInput(d, win->w, wa.event_mask);
+    }
+
+    if (use_render_thread) {
+        /* window and counters must exist before the render thread uses them */
+        XSync(d, False);
+
+        spsc_queue_init(&render_queue, sizeof(render_msg), RENDER_QUEUE_SIZE);
+        render_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (render_eventfd < 0) {
+            Panic("eventfd error: %s\n", strerror(errno));
+        }
+        wakeup_init(&message_wakeup, render_eventfd);
+
+        render_args = (render_thread_args) { rd };
+        if (pthread_create(&render_thread, NULL, render_thread_main,
+                           &render_args) != 0) {
+            Panic("Cannot create render thread\n");
+        }
+
+        for (;;)
+        {
+            /* wait until next event */
+            while (XEventsQueued(d, QueuedAlready) == 0)
+            {
+                wait_event(d);
+            }
+
+            /* process event queue without blocking */
+            process_events(d);
+
+            /* flush ping replies */
+            XFlush(d);
+        }
+
+        pthread_join(render_thread, NULL);
+        close(render_eventfd);
+        spsc_queue_destroy(&render_queue);
+    }
+
+    window_make_current(d, &windows[0]);
+
+    init();
+    window_start_frames();
 
     for (;;)
     {
         /* wait until next frame or next event */
         while (XEventsQueued(d, QueuedAlready) == 0)
         {
-            switch (wait_frame_or_event(d, w)) {
+            switch (wait_frame_or_event(d)) {
             case event_ready: break;
-            case frame_ready: submit_frame(d, w, frame_normal, frame_rate);
+            case frame_ready:
+                submit_frame(d, window_next(), frame_normal, frame_rate);
             }
         }
 
         /* process event queue without blocking */
-        while (XEventsQueued(d, QueuedAlready) > 0)
-        {
-            process_event(d, w);
-        }
+        process_events(d);
     }
 
     XFree(supported_atoms);
-    glXDestroyContext(d, ctx);
-    XDestroyWindow(d, w);
+    atom_cache_destroy();
+    glXDestroyContext(rd, render_context);
+    for (uint i = 0; i < num_windows; i++) {
+        XDestroyWindow(d, windows[i].w);
+    }
+    if (rd != d) XCloseDisplay(rd);
     XCloseDisplay(d);
 }
 
@@ -857,9 +3490,36 @@ int print_usage_and_exit(const char *argv0)
                     "-h, --help              print this help message\n"
                     "-d, --debug             enable debug messages\n"
                     "-t, --trace             enable trace messages\n"
+                    "-T, --trace-file <file> record binary frame trace\n"
+                    "-X, --metrics <file>    publish live frame metrics\n"
                     "-n, --no-sync           disable frame synchronization\n"
-                    "-f, --frame-rate <fps>  target frame rate (default %.2f)\n\n",
-        argv0, frame_rate);
+                    "-v, --vblank-sync       phase-lock frames to predicted vblank\n"
+                    "-l, --vblank-lead <us>  vblank lead time (default %ld)\n"
+                    "-r, --render-thread     render on a separate thread\n"
+                    "-i, --instances <n>     number of cubes (default %u)\n"
+                    "-j, --jobs <n>          transform job threads (default ncpu-1)\n"
+                    "-M, --mesh <file>       draw a mesh file instead of a cube\n"
+                    "-O, --optimize          optimize procedural mesh for vertex cache\n"
+                    "-a, --arena             build procedural meshes in a scene arena\n"
+                    "-z, --overdraw          also reorder procedural mesh for overdraw\n"
+                    "-R, --dynamic-res       scale resolution to hold frame rate\n"
+                    "-A, --no-animation      draw a static scene\n"
+                    "-I, --no-idle           keep pacing hidden, static and unfocused windows\n"
+                    "-W, --windows <n>       number of windows (default 1, max %u)\n"
+                    "-p, --present           use Present events for frame timings\n"
+                    "-m, --max-inflight <n>  frames in flight (default %u, max %u)\n"
+                    "-s, --cache-dir <dir>   program binary cache directory\n"
+                    "-S, --no-cache          disable program binary cache\n"
+                    "-D, --define <name=n>   shader define, e.g. NROUNDS, LIGHTING\n"
+                    "-N, --noise <mode>      fragment noise: off, hash or lut (default hash)\n"
+                    "-f, --frame-rate <fps>  target frame rate (default %.2f)\n"
+                    "-F, --auto-rate         pick a divisor of the refresh rate, implies -v\n"
+                    "-b, --bench <frames>    render frames headless with a scripted compositor\n"
+                    "-L, --latency <us>      bench compositor latency (default %ld)\n"
+                    "-J, --jitter <us>       bench compositor latency jitter (default %ld)\n"
+                    "-C, --storm <n>         bench configure storm every n frames (default off)\n\n",
+        argv0, vblank_lead, num_instances, MAX_WINDOWS, max_inflight,
+        MAX_INFLIGHT_FRAMES, frame_rate, script_latency, script_jitter);
     exit(9);
 }
 
@@ -875,12 +3535,89 @@ int main(int argc, char **argv)
             help = 1;
         } else if (match_option(argv[i], "-t", "--trace")) {
             debug = trace = 1;
+        } else if (match_option(argv[i], "-T", "--trace-file") && i+1 < argc) {
+            trace_filename = argv[++i];
+        } else if (match_option(argv[i], "-X", "--metrics") && i+1 < argc) {
+            metrics_filename = argv[++i];
         } else if (match_option(argv[i], "-d", "--debug")) {
             debug = 1;
         } else if (match_option(argv[i], "-n", "--no-sync")) {
             use_frame_sync = 0;
+        } else if (match_option(argv[i], "-v", "--vblank-sync")) {
+            scheduler = schedule_vblank;
+        } else if (match_option(argv[i], "-l", "--vblank-lead") && i+1 < argc) {
+            vblank_lead = atol(argv[++i]);
+        } else if (match_option(argv[i], "-r", "--render-thread")) {
+            use_render_thread = 1;
+        } else if (match_option(argv[i], "-i", "--instances") && i+1 < argc) {
+            int instances = atoi(argv[++i]);
+            num_instances = instances < 1 ? 1 : instances;
+        } else if (match_option(argv[i], "-j", "--jobs") && i+1 < argc) {
+            num_job_threads = atoi(argv[++i]);
+            if (num_job_threads < 0) num_job_threads = 0;
+        } else if (match_option(argv[i], "-M", "--mesh") && i+1 < argc) {
+            mesh_filename = argv[++i];
+        } else if (match_option(argv[i], "-R", "--dynamic-res")) {
+            use_dynamic_resolution = 1;
+        } else if (match_option(argv[i], "-A", "--no-animation")) {
+            animation = 0;
+        } else if (match_option(argv[i], "-I", "--no-idle")) {
+            use_idle_policy = 0;
+        } else if (match_option(argv[i], "-W", "--windows") && i+1 < argc) {
+            int count = atoi(argv[++i]);
+            if (count < 1) count = 1;
+            if (count > MAX_WINDOWS) count = MAX_WINDOWS;
+            num_windows = count;
+        } else if (match_option(argv[i], "-p", "--present")) {
+            timing_source = timing_present;
+        } else if (match_option(argv[i], "-a", "--arena")) {
+            use_scene_arena = 1;
+        } else if (match_option(argv[i], "-O", "--optimize")) {
+            optimize_mesh = 1;
+        } else if (match_option(argv[i], "-z", "--overdraw")) {
+            optimize_mesh = optimize_overdraw = 1;
+        } else if (match_option(argv[i], "-m", "--max-inflight") && i+1 < argc) {
+            int inflight = atoi(argv[++i]);
+            if (inflight < 1) inflight = 1;
+            if (inflight > MAX_INFLIGHT_FRAMES) inflight = MAX_INFLIGHT_FRAMES;
+            max_inflight = inflight;
+        } else if (match_option(argv[i], "-s", "--cache-dir") && i+1 < argc) {
+            shader_cache_dir = argv[++i];
+        } else if (match_option(argv[i], "-S", "--no-cache")) {
+            use_shader_cache = 0;
+        } else if (match_option(argv[i], "-D", "--define") && i+1 < argc) {
+            char *name = argv[++i], *value = strchr(name, '=');
+            if (value) *value++ = 0;
+            shader_define_set(name, value ? atoi(value) : 1);
+        } else if (match_option(argv[i], "-N", "--noise") && i+1 < argc) {
+            const char *mode = argv[++i];
+            int found = 0;
+            for (size_t j = 0; j < array_size(noise_mode_names); j++) {
+                if (strcmp(mode, noise_mode_names[j]) == 0) {
+                    shader_define_set("NOISE", (int)j);
+                    found = 1;
+                }
+            }
+            if (!found) {
+                fprintf(stderr, "unknown noise mode: %s\n", mode);
+                help = 1;
+            }
         } else if (match_option(argv[i], "-f", "--frame-rate") && i+1 < argc) {
-            frame_rate = atoi(argv[++i]);
+            frame_rate = (float)atof(argv[++i]);
+        } else if (match_option(argv[i], "-F", "--auto-rate")) {
+            use_auto_rate = 1;
+            scheduler = schedule_vblank;
+        } else if (match_option(argv[i], "-b", "--bench") && i+1 < argc) {
+            bench_frames = strtoul(argv[++i], NULL, 10);
+        } else if (match_option(argv[i], "-L", "--latency") && i+1 < argc) {
+            script_latency = atol(argv[++i]);
+            if (script_latency < 0) script_latency = 0;
+        } else if (match_option(argv[i], "-J", "--jitter") && i+1 < argc) {
+            script_jitter = atol(argv[++i]);
+            if (script_jitter < 0) script_jitter = 0;
+        } else if (match_option(argv[i], "-C", "--storm") && i+1 < argc) {
+            int storm_interval = atoi(argv[++i]);
+            script_storm_interval = storm_interval < 0 ? 0 : storm_interval;
         } else {
             fprintf(stderr, "unknown option: %s\n", argv[i]);
             help = 1;
@@ -889,7 +3626,22 @@ int main(int argc, char **argv)
 
     if (help) print_usage_and_exit(argv[0]);
 
-    app_run(argv[0]);
+    if (trace_filename && frame_trace_create(&trace_file, trace_filename,
+            FRAME_TRACE_DEFAULT_CAPACITY, get_time_microseconds()) < 0) {
+        Panic("Cannot create trace file: %s: %s\n",
+            trace_filename, strerror(errno));
+    }
+    if (metrics_filename && frame_metrics_create(&metrics_file,
+            metrics_filename, num_windows, get_time_microseconds()) < 0) {
+        Panic("Cannot create metrics file: %s: %s\n",
+            metrics_filename, strerror(errno));
+    }
+
+    if (bench_frames) {
+        app_bench(argv[0]);
+    } else {
+        app_run(argv[0]);
+    }
 
     return 0;
 }
@@ -0,0 +1,307 @@
+/*
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * work-stealing job system
+ *
+ * a job is a function applied to a half-open index range. each worker,
+ * and the submitting thread in slot zero, owns a deque of jobs. owners
+ * push and pop at the tail, idle workers steal from the head of other
+ * deques, so a worker keeps touching the cache lines of its own chunks
+ * while stragglers are picked up by whoever is free. deques are guarded
+ * by a per-deque mutex, which is uncontended except while stealing.
+ *
+ * jobs are only submitted by one thread, which must call job_system_wait
+ * before reading results. job_system_wait runs queued jobs on the calling
+ * thread and returns once every submitted job has completed, making it
+ * the join point. jobs must write disjoint outputs for results to be
+ * independent of the order jobs are run in.
+ */
+
+enum { JOB_CACHE_LINE_SIZE = 64 };
+enum { JOB_MAX_THREADS = 32 };
+enum { JOB_DEQUE_INITIAL_SIZE = 64 };
+
+typedef void (*job_fn)(void *arg, unsigned begin, unsigned end);
+
+typedef struct
+{
+    job_fn fn;
+    void *arg;
+    unsigned begin;
+    unsigned end;
+} job;
+
+typedef struct
+{
+    _Alignas(JOB_CACHE_LINE_SIZE) pthread_mutex_t lock;
+    job *jobs;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} job_deque;
+
+typedef struct job_system job_system;
+
+typedef struct
+{
+    job_system *js;
+    unsigned id;
+} job_worker;
+
+struct job_system
+{
+    unsigned num_threads;
+    job_deque deques[JOB_MAX_THREADS + 1];
+    job_worker workers[JOB_MAX_THREADS + 1];
+    pthread_t threads[JOB_MAX_THREADS];
+    _Alignas(JOB_CACHE_LINE_SIZE) atomic_uint pending;
+    unsigned next_deque;
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake_cond;
+    unsigned generation;
+    int quit;
+};
+
+static int job_system_init(job_system *js, unsigned num_threads);
+static void job_system_destroy(job_system *js);
+static void job_system_parallel_for(job_system *js, job_fn fn, void *arg,
+    unsigned count, unsigned grain);
+static void job_system_wait(job_system *js);
+static unsigned job_system_default_threads();
+
+static void job_deque_init(job_deque *q)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    q->jobs = (job*)malloc(sizeof(job) * JOB_DEQUE_INITIAL_SIZE);
+    q->head = q->tail = 0;
+    q->capacity = JOB_DEQUE_INITIAL_SIZE;
+}
+
+static void job_deque_destroy(job_deque *q)
+{
+    pthread_mutex_destroy(&q->lock);
+    free(q->jobs);
+    q->jobs = NULL;
+}
+
+/*
+ * jobs occupy head..tail modulo a power of two capacity
+ */
+static void job_deque_push(job_deque *q, const job *j)
+{
+    pthread_mutex_lock(&q->lock);
+    if (q->tail - q->head == q->capacity) {
+        job *jobs = (job*)malloc(sizeof(job) * q->capacity * 2);
+        for (size_t i = q->head; i != q->tail; i++) {
+            jobs[i & (q->capacity * 2 - 1)] = q->jobs[i & (q->capacity - 1)];
+        }
+        free(q->jobs);
+        q->jobs = jobs;
+        q->capacity *= 2;
+    }
+    q->jobs[q->tail++ & (q->capacity - 1)] = *j;
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int job_deque_pop(job_deque *q, job *j)
+{
+    int found = 0;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail != q->head) {
+        *j = q->jobs[--q->tail & (q->capacity - 1)];
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+static int job_deque_steal(job_deque *q, job *j)
+{
+    int found = 0;
+    if (pthread_mutex_trylock(&q->lock) != 0) return 0;
+    if (q->tail != q->head) {
+        *j = q->jobs[q->head++ & (q->capacity - 1)];
+        found = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return found;
+}
+
+/*
+ * take a job from our own deque, otherwise steal starting at our neighbour
+ */
+static int job_system_take(job_system *js, unsigned id, job *j)
+{
+    unsigned n = js->num_threads + 1;
+    if (job_deque_pop(&js->deques[id], j)) return 1;
+    for (unsigned i = 1; i < n; i++) {
+        if (job_deque_steal(&js->deques[(id + i) % n], j)) return 1;
+    }
+    return 0;
+}
+
+static void job_system_run(job_system *js, job *j)
+{
+    j->fn(j->arg, j->begin, j->end);
+    atomic_fetch_sub_explicit(&js->pending, 1, memory_order_release);
+}
+
+/*
+ * workers record the generation before looking for work and only sleep
+ * if no jobs were submitted in the meantime, so wakeups are never lost.
+ */
+static void* job_system_worker_main(void *arg)
+{
+    job_worker *worker = (job_worker*)arg;
+    job_system *js = worker->js;
+    job j;
+
+    for (;;) {
+        pthread_mutex_lock(&js->wake_lock);
+        unsigned generation = js->generation;
+        int quit = js->quit;
+        pthread_mutex_unlock(&js->wake_lock);
+        if (quit) break;
+
+        while (job_system_take(js, worker->id, &j)) {
+            job_system_run(js, &j);
+        }
+
+        pthread_mutex_lock(&js->wake_lock);
+        while (!js->quit && js->generation == generation) {
+            pthread_cond_wait(&js->wake_cond, &js->wake_lock);
+        }
+        pthread_mutex_unlock(&js->wake_lock);
+    }
+
+    return NULL;
+}
+
+static unsigned job_system_default_threads()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (n < 0) n = 0;
+    if (n > JOB_MAX_THREADS) n = JOB_MAX_THREADS;
+    return (unsigned)n;
+}
+
+static void job_system_stop(job_system *js, unsigned started)
+{
+    pthread_mutex_lock(&js->wake_lock);
+    js->quit = 1;
+    pthread_cond_broadcast(&js->wake_cond);
+    pthread_mutex_unlock(&js->wake_lock);
+
+    for (unsigned i = 0; i < started; i++) {
+        pthread_join(js->threads[i], NULL);
+    }
+    for (unsigned i = 0; i <= js->num_threads; i++) {
+        job_deque_destroy(&js->deques[i]);
+    }
+    pthread_cond_destroy(&js->wake_cond);
+    pthread_mutex_destroy(&js->wake_lock);
+}
+
+/*
+ * num_threads worker threads are created in addition to the caller,
+ * zero workers runs all jobs on the caller. returns -1 if a worker
+ * thread could not be created.
+ */
+static int job_system_init(job_system *js, unsigned num_threads)
+{
+    memset(js, 0, sizeof(job_system));
+    if (num_threads > JOB_MAX_THREADS) num_threads = JOB_MAX_THREADS;
+    js->num_threads = num_threads;
+    atomic_init(&js->pending, 0);
+    pthread_mutex_init(&js->wake_lock, NULL);
+    pthread_cond_init(&js->wake_cond, NULL);
+
+    for (unsigned i = 0; i <= num_threads; i++) {
+        job_deque_init(&js->deques[i]);
+        js->workers[i] = (job_worker) { js, i };
+    }
+    for (unsigned i = 0; i < num_threads; i++) {
+        if (pthread_create(&js->threads[i], NULL, job_system_worker_main,
+                           &js->workers[i + 1]) != 0) {
+            job_system_stop(js, i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void job_system_destroy(job_system *js)
+{
+    job_system_wait(js);
+    job_system_stop(js, js->num_threads);
+}
+
+/*
+ * split 0..count into chunks of at least grain indices and distribute
+ * them round-robin across the deques. ranges that fit in a single chunk,
+ * or a job system without workers, are run immediately on the caller.
+ */
+static void job_system_parallel_for(job_system *js, job_fn fn, void *arg,
+    unsigned count, unsigned grain)
+{
+    unsigned n = js->num_threads + 1;
+    if (grain == 0) grain = 1;
+    if (js->num_threads == 0 || count <= grain) {
+        if (count > 0) fn(arg, 0, count);
+        return;
+    }
+
+    /* aim for a few chunks per thread so that stealing can balance load */
+    unsigned chunk = (count + n * 4 - 1) / (n * 4);
+    if (chunk < grain) chunk = grain;
+
+    unsigned chunks = (count + chunk - 1) / chunk;
+    atomic_fetch_add_explicit(&js->pending, chunks, memory_order_relaxed);
+    for (unsigned begin = 0; begin < count; begin += chunk) {
+        unsigned end = begin + chunk < count ? begin + chunk : count;
+        job j = { fn, arg, begin, end };
+        job_deque_push(&js->deques[js->next_deque++ % n], &j);
+    }
+
+    pthread_mutex_lock(&js->wake_lock);
+    js->generation++;
+    pthread_cond_broadcast(&js->wake_cond);
+    pthread_mutex_unlock(&js->wake_lock);
+}
+
+/*
+ * help run jobs until every job submitted so far has completed
+ */
+static void job_system_wait(job_system *js)
+{
+    job j;
+    while (atomic_load_explicit(&js->pending, memory_order_acquire) != 0) {
+        if (job_system_take(js, 0, &j)) {
+            job_system_run(js, &j);
+        } else {
+            sched_yield();
+        }
+    }
+}
@@ -2,11 +2,54 @@
 #define LINMATH_H
 
 #include <math.h>
+#include <stddef.h>
 
 #ifdef _MSC_VER
 #define inline __inline
 #endif
 
+/*
+ * matrix kernels use 4-wide vectors when the target supports them:
+ * AVX2 and FMA, SSE, or NEON, selected at compile time. columns are
+ * loaded unaligned so that mat4x4 keeps its plain float layout. define
+ * LINMATH_NO_SIMD to build the scalar kernels.
+ */
+#if defined(LINMATH_NO_SIMD)
+/* scalar kernels only */
+#elif defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define LINMATH_SIMD 1
+typedef __m128 linmath_v4;
+#define linmath_v4_load(p) _mm_loadu_ps(p)
+#define linmath_v4_store(p, v) _mm_storeu_ps(p, v)
+#define linmath_v4_splat(s) _mm_set1_ps(s)
+#define linmath_v4_mul(a, b) _mm_mul_ps(a, b)
+#define linmath_v4_add(a, b) _mm_add_ps(a, b)
+#if defined(__FMA__)
+#define linmath_v4_madd(a, b, c) _mm_fmadd_ps(b, c, a)
+#else
+#define linmath_v4_madd(a, b, c) _mm_add_ps(a, _mm_mul_ps(b, c))
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define LINMATH_SIMD 1
+typedef float32x4_t linmath_v4;
+#define linmath_v4_load(p) vld1q_f32(p)
+#define linmath_v4_store(p, v) vst1q_f32(p, v)
+#define linmath_v4_splat(s) vdupq_n_f32(s)
+#define linmath_v4_mul(a, b) vmulq_f32(a, b)
+#define linmath_v4_add(a, b) vaddq_f32(a, b)
+#if defined(__aarch64__)
+#define linmath_v4_madd(a, b, c) vfmaq_f32(a, b, c)
+#else
+#define linmath_v4_madd(a, b, c) vmlaq_f32(a, b, c)
+#endif
+#endif
+
+#if !defined(LINMATH_NO_SIMD) && defined(__AVX2__) && defined(__FMA__)
+#define LINMATH_AVX2 1
+#endif
+
 #define LINMATH_H_DEFINE_VEC(n) \
 typedef float vec##n[n]; \
 static inline void vec##n##_add(vec##n r, vec##n const a, vec##n const b) \
@@ -134,6 +177,13 @@ static inline void mat4x4_scale(mat4x4 M, mat4x4 a, float k)
 }
 static inline void mat4x4_scale_aniso(mat4x4 M, mat4x4 a, float x, float y, float z)
 {
+#if defined(LINMATH_SIMD)
+	linmath_v4 a3 = linmath_v4_load(a[3]);
+	linmath_v4_store(M[0], linmath_v4_mul(linmath_v4_load(a[0]), linmath_v4_splat(x)));
+	linmath_v4_store(M[1], linmath_v4_mul(linmath_v4_load(a[1]), linmath_v4_splat(y)));
+	linmath_v4_store(M[2], linmath_v4_mul(linmath_v4_load(a[2]), linmath_v4_splat(z)));
+	linmath_v4_store(M[3], a3);
+#else
 	int i;
 	vec4_scale(M[0], a[0], x);
 	vec4_scale(M[1], a[1], y);
@@ -141,9 +191,26 @@ static inline void mat4x4_scale_aniso(mat4x4 M, mat4x4 a, float x, float y, floa
 	for(i = 0; i < 4; ++i) {
 		M[3][i] = a[3][i];
 	}
+#endif
 }
 static inline void mat4x4_mul(mat4x4 M, mat4x4 a, mat4x4 b)
 {
+#if defined(LINMATH_SIMD)
+	linmath_v4 a0 = linmath_v4_load(a[0]);
+	linmath_v4 a1 = linmath_v4_load(a[1]);
+	linmath_v4 a2 = linmath_v4_load(a[2]);
+	linmath_v4 a3 = linmath_v4_load(a[3]);
+	linmath_v4 r[4];
+	int c;
+	for(c=0; c<4; ++c) {
+		r[c] = linmath_v4_mul(a0, linmath_v4_splat(b[c][0]));
+		r[c] = linmath_v4_madd(r[c], a1, linmath_v4_splat(b[c][1]));
+		r[c] = linmath_v4_madd(r[c], a2, linmath_v4_splat(b[c][2]));
+		r[c] = linmath_v4_madd(r[c], a3, linmath_v4_splat(b[c][3]));
+	}
+	for(c=0; c<4; ++c)
+		linmath_v4_store(M[c], r[c]);
+#else
 	mat4x4 temp;
 	int k, r, c;
 	for(c=0; c<4; ++c) for(r=0; r<4; ++r) {
@@ -152,6 +219,7 @@ static inline void mat4x4_mul(mat4x4 M, mat4x4 a, mat4x4 b)
 			temp[c][r] += a[k][r] * b[c][k];
 	}
 	mat4x4_dup(M, temp);
+#endif
 }
 static inline void mat4x4_mul_vec4(vec4 r, mat4x4 M, vec4 v)
 {
@@ -171,6 +239,13 @@ static inline void mat4x4_translate(mat4x4 T, float x, float y, float z)
 }
 static inline void mat4x4_translate_in_place(mat4x4 M, float x, float y, float z)
 {
+#if defined(LINMATH_SIMD)
+	linmath_v4 r = linmath_v4_load(M[3]);
+	r = linmath_v4_madd(r, linmath_v4_load(M[0]), linmath_v4_splat(x));
+	r = linmath_v4_madd(r, linmath_v4_load(M[1]), linmath_v4_splat(y));
+	r = linmath_v4_madd(r, linmath_v4_load(M[2]), linmath_v4_splat(z));
+	linmath_v4_store(M[3], r);
+#else
 	vec4 t = {x, y, z, 0};
 	vec4 r;
 	int i;
@@ -178,6 +253,7 @@ static inline void mat4x4_translate_in_place(mat4x4 M, float x, float y, float z
 		mat4x4_row(r, M, i);
 		M[3][i] += vec4_mul_inner(r, t);
 	}
+#endif
 }
 static inline void mat4x4_from_vec3_mul_outer(mat4x4 M, vec3 a, vec3 b)
 {
@@ -220,41 +296,150 @@ static inline void mat4x4_rotate(mat4x4 R, mat4x4 M, float x, float y, float z,
 		mat4x4_dup(R, M);
 	}
 }
-static inline void mat4x4_rotate_X(mat4x4 Q, mat4x4 M, float angle)
+/*
+ * rotating about an axis only mixes the two columns orthogonal to it:
+ * Q[i] = c*M[i] + s*M[j] and Q[j] = c*M[j] - s*M[i]
+ */
+static inline void mat4x4_rotate_cols(mat4x4 Q, mat4x4 M, int i, int j, float angle)
 {
 	float s = sinf(angle);
 	float c = cosf(angle);
-	mat4x4 R = {
-		{1.f, 0.f, 0.f, 0.f},
-		{0.f,   c,   s, 0.f},
-		{0.f,  -s,   c, 0.f},
-		{0.f, 0.f, 0.f, 1.f}
-	};
-	mat4x4_mul(Q, M, R);
+	int k;
+#if defined(LINMATH_SIMD)
+	linmath_v4 mi = linmath_v4_load(M[i]);
+	linmath_v4 mj = linmath_v4_load(M[j]);
+	linmath_v4 vc = linmath_v4_splat(c);
+	linmath_v4_store(Q[i], linmath_v4_madd(linmath_v4_mul(mi, vc), mj, linmath_v4_splat(s)));
+	linmath_v4_store(Q[j], linmath_v4_madd(linmath_v4_mul(mj, vc), mi, linmath_v4_splat(-s)));
+#else
+	for(k=0; k<4; ++k) {
+		float a = M[i][k], b = M[j][k];
+		Q[i][k] = c*a + s*b;
+		Q[j][k] = c*b - s*a;
+	}
+#endif
+	if(Q != M) for(k=0; k<4; ++k) if(k != i && k != j) {
+		int r;
+		for(r=0; r<4; ++r)
+			Q[k][r] = M[k][r];
+	}
+}
+static inline void mat4x4_rotate_X(mat4x4 Q, mat4x4 M, float angle)
+{
+	mat4x4_rotate_cols(Q, M, 1, 2, angle);
 }
 static inline void mat4x4_rotate_Y(mat4x4 Q, mat4x4 M, float angle)
 {
-	float s = sinf(angle);
-	float c = cosf(angle);
-	mat4x4 R = {
-		{   c, 0.f,   s, 0.f},
-		{ 0.f, 1.f, 0.f, 0.f},
-		{  -s, 0.f,   c, 0.f},
-		{ 0.f, 0.f, 0.f, 1.f}
-	};
-	mat4x4_mul(Q, M, R);
+	mat4x4_rotate_cols(Q, M, 0, 2, angle);
 }
 static inline void mat4x4_rotate_Z(mat4x4 Q, mat4x4 M, float angle)
 {
-	float s = sinf(angle);
-	float c = cosf(angle);
-	mat4x4 R = {
-		{   c,   s, 0.f, 0.f},
-		{  -s,   c, 0.f, 0.f},
-		{ 0.f, 0.f, 1.f, 0.f},
-		{ 0.f, 0.f, 0.f, 1.f}
-	};
-	mat4x4_mul(Q, M, R);
+	mat4x4_rotate_cols(Q, M, 0, 1, angle);
+}
+/*
+ * fused scale, translate and Euler rotation, equivalent to identity
+ * followed by scale_aniso, translate_in_place, rotate_X, rotate_Y and
+ * rotate_Z, that is M = S * T * Rx * Ry * Rz, without the multiplies.
+ */
+static inline void mat4x4_compose_trs(mat4x4 M, vec3 const scale, vec3 const trans, vec3 const rot)
+{
+	float sx = sinf(rot[0]), cx = cosf(rot[0]);
+	float sy = sinf(rot[1]), cy = cosf(rot[1]);
+	float sz = sinf(rot[2]), cz = cosf(rot[2]);
+	int i;
+
+	M[0][0] = cz*cy;
+	M[0][1] = cz*sy*-sx + sz*cx;
+	M[0][2] = cz*sy*cx + sz*sx;
+	M[1][0] = -sz*cy;
+	M[1][1] = sz*sy*sx + cz*cx;
+	M[1][2] = -sz*sy*cx + cz*sx;
+	M[2][0] = -sy;
+	M[2][1] = -cy*sx;
+	M[2][2] = cy*cx;
+	for(i=0; i<3; ++i) {
+		M[i][0] *= scale[0];
+		M[i][1] *= scale[1];
+		M[i][2] *= scale[2];
+		M[i][3] = 0.f;
+		M[3][i] = scale[i] * trans[i];
+	}
+	M[3][3] = 1.f;
+}
+/*
+ * batched multiply R[i] = A[i] * B[i] over n matrices stored as structure
+ * of arrays: element [c][r] of matrix i is at m[(c*4 + r)*n + i]. lanes
+ * hold consecutive matrices so each element is a single multiply-add.
+ */
+static inline void mat4x4_soa_load(mat4x4 M, float const *m, size_t n, size_t i)
+{
+	int c, r;
+	for(c=0; c<4; ++c) for(r=0; r<4; ++r)
+		M[c][r] = m[(c*4 + r)*n + i];
+}
+static inline void mat4x4_soa_store(float *m, size_t n, size_t i, mat4x4 M)
+{
+	int c, r;
+	for(c=0; c<4; ++c) for(r=0; r<4; ++r)
+		m[(c*4 + r)*n + i] = M[c][r];
+}
+static inline void mat4x4_mul_n(float *R, float const *A, float const *B, size_t n)
+{
+	size_t i = 0;
+	int c, r, k;
+#if defined(LINMATH_AVX2)
+	for(; i + 8 <= n; i += 8) {
+		__m256 a[16], res[16];
+		for(k=0; k<16; ++k)
+			a[k] = _mm256_loadu_ps(A + k*n + i);
+		for(c=0; c<4; ++c) {
+			__m256 b0 = _mm256_loadu_ps(B + (c*4 + 0)*n + i);
+			__m256 b1 = _mm256_loadu_ps(B + (c*4 + 1)*n + i);
+			__m256 b2 = _mm256_loadu_ps(B + (c*4 + 2)*n + i);
+			__m256 b3 = _mm256_loadu_ps(B + (c*4 + 3)*n + i);
+			for(r=0; r<4; ++r) {
+				__m256 v = _mm256_mul_ps(a[0*4 + r], b0);
+				v = _mm256_fmadd_ps(a[1*4 + r], b1, v);
+				v = _mm256_fmadd_ps(a[2*4 + r], b2, v);
+				res[c*4 + r] = _mm256_fmadd_ps(a[3*4 + r], b3, v);
+			}
+		}
+		for(k=0; k<16; ++k)
+			_mm256_storeu_ps(R + k*n + i, res[k]);
+	}
+#endif
+#if defined(LINMATH_SIMD)
+	for(; i + 4 <= n; i += 4) {
+		linmath_v4 a[16], res[16];
+		for(k=0; k<16; ++k)
+			a[k] = linmath_v4_load(A + k*n + i);
+		for(c=0; c<4; ++c) {
+			linmath_v4 b0 = linmath_v4_load(B + (c*4 + 0)*n + i);
+			linmath_v4 b1 = linmath_v4_load(B + (c*4 + 1)*n + i);
+			linmath_v4 b2 = linmath_v4_load(B + (c*4 + 2)*n + i);
+			linmath_v4 b3 = linmath_v4_load(B + (c*4 + 3)*n + i);
+			for(r=0; r<4; ++r) {
+				linmath_v4 v = linmath_v4_mul(a[0*4 + r], b0);
+				v = linmath_v4_madd(v, a[1*4 + r], b1);
+				v = linmath_v4_madd(v, a[2*4 + r], b2);
+				res[c*4 + r] = linmath_v4_madd(v, a[3*4 + r], b3);
+			}
+		}
+		for(k=0; k<16; ++k)
+			linmath_v4_store(R + k*n + i, res[k]);
+	}
+#endif
+	for(; i < n; ++i) {
+		float res[16];
+		for(c=0; c<4; ++c) for(r=0; r<4; ++r) {
+			float v = 0.f;
+			for(k=0; k<4; ++k)
+				v += A[(k*4 + r)*n + i] * B[(c*4 + k)*n + i];
+			res[c*4 + r] = v;
+		}
+		for(k=0; k<16; ++k)
+			R[k*n + i] = res[k];
+	}
 }
 static inline void mat4x4_invert(mat4x4 T, mat4x4 M)
 {
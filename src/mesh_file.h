@@ -0,0 +1,227 @@
+/*
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * binary mesh file
+ *
+ * a little-endian file with a header, an attribute table, an interleaved
+ * vertex array and an index array, laid out so that it can be mapped and
+ * the vertex and index ranges handed directly to glBufferData. attributes
+ * may be quantized and are described by format:
+ *
+ * - mesh_format_float2/3/4    32-bit float components
+ * - mesh_format_half2         16-bit half float components, for uvs
+ * - mesh_format_snorm10x3     signed normalized 10_10_10_2, for normals
+ * - mesh_format_unorm8x4      unsigned normalized bytes, for colours
+ *
+ * indices are 16-bit when the vertex count fits, otherwise 32-bit.
+ * ranges are aligned to MESH_FILE_ALIGN bytes from the start of the file.
+ */
+
+#define MESH_FILE_MAGIC 0x4853454d /* "MESH" */
+
+enum { MESH_FILE_VERSION = 1 };
+enum { MESH_FILE_ALIGN = 16 };
+enum { MESH_FILE_MAX_ATTRS = 8 };
+
+typedef enum {
+    mesh_attr_pos,
+    mesh_attr_normal,
+    mesh_attr_uv,
+    mesh_attr_color,
+    mesh_attr_count
+} mesh_attr_semantic;
+
+typedef enum {
+    mesh_format_float2,
+    mesh_format_float3,
+    mesh_format_float4,
+    mesh_format_half2,
+    mesh_format_snorm10x3,
+    mesh_format_unorm8x4,
+    mesh_format_count
+} mesh_attr_format;
+
+typedef enum {
+    mesh_index_u16,
+    mesh_index_u32
+} mesh_index_type;
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t attr_count;
+    uint32_t vertex_count;
+    uint32_t vertex_stride;
+    uint32_t index_count;
+    uint32_t index_type;
+    uint64_t vertex_offset;
+    uint64_t index_offset;
+    float bounds_min[3];
+    float bounds_max[3];
+} mesh_file_header;
+
+typedef struct
+{
+    uint16_t semantic;
+    uint16_t format;
+    uint32_t offset;
+} mesh_file_attr;
+
+static const char* mesh_attr_semantic_names[] = {
+    [mesh_attr_pos] = "pos",
+    [mesh_attr_normal] = "normal",
+    [mesh_attr_uv] = "uv",
+    [mesh_attr_color] = "color",
+};
+
+static const uint32_t mesh_attr_format_sizes[] = {
+    [mesh_format_float2] = 8,
+    [mesh_format_float3] = 12,
+    [mesh_format_float4] = 16,
+    [mesh_format_half2] = 4,
+    [mesh_format_snorm10x3] = 4,
+    [mesh_format_unorm8x4] = 4,
+};
+
+static size_t mesh_file_align(size_t offset);
+static size_t mesh_index_size(uint32_t index_type);
+static const mesh_file_header* mesh_file_validate(const void *data,
+    size_t length);
+static const mesh_file_attr* mesh_file_attrs(const mesh_file_header *hdr);
+static uint16_t mesh_float_to_half(float f);
+static uint32_t mesh_pack_snorm10x3(float x, float y, float z);
+static uint32_t mesh_pack_unorm8x4(float r, float g, float b, float a);
+
+static size_t mesh_file_align(size_t offset)
+{
+    return (offset + MESH_FILE_ALIGN - 1) & ~(size_t)(MESH_FILE_ALIGN - 1);
+}
+
+static size_t mesh_index_size(uint32_t index_type)
+{
+    return index_type == mesh_index_u16 ? 2 : 4;
+}
+
+static const mesh_file_attr* mesh_file_attrs(const mesh_file_header *hdr)
+{
+    return (const mesh_file_attr*)(hdr + 1);
+}
+
+/*
+ * check the header, that all ranges lie within the mapping and that all
+ * indices are in range, returns the header or NULL if the file is not a
+ * valid mesh file.
+ */
+static const mesh_file_header* mesh_file_validate(const void *data,
+    size_t length)
+{
+    const mesh_file_header *hdr = (const mesh_file_header*)data;
+    const mesh_file_attr *attrs;
+    uint64_t vertex_size, index_size;
+
+    if (length < sizeof(mesh_file_header)) return NULL;
+    if (hdr->magic != MESH_FILE_MAGIC || hdr->version != MESH_FILE_VERSION ||
+        hdr->attr_count > MESH_FILE_MAX_ATTRS ||
+        hdr->index_type > mesh_index_u32 ||
+        sizeof(mesh_file_header) + hdr->attr_count * sizeof(mesh_file_attr) >
+            length) {
+        return NULL;
+    }
+
+    attrs = mesh_file_attrs(hdr);
+    for (uint32_t i = 0; i < hdr->attr_count; i++) {
+        if (attrs[i].semantic >= mesh_attr_count ||
+            attrs[i].format >= mesh_format_count ||
+            (uint64_t)attrs[i].offset +
+                mesh_attr_format_sizes[attrs[i].format] > hdr->vertex_stride) {
+            return NULL;
+        }
+    }
+
+    vertex_size = (uint64_t)hdr->vertex_count * hdr->vertex_stride;
+    index_size = (uint64_t)hdr->index_count * mesh_index_size(hdr->index_type);
+    if (hdr->vertex_offset > length || vertex_size > length - hdr->vertex_offset ||
+        hdr->index_offset > length || index_size > length - hdr->index_offset ||
+        hdr->index_offset % mesh_index_size(hdr->index_type) != 0) {
+        return NULL;
+    }
+
+    /* every index must address a vertex in the vertex range */
+    const uint8_t *indices = (const uint8_t*)data + hdr->index_offset;
+    for (uint32_t i = 0; i < hdr->index_count; i++) {
+        uint32_t index = hdr->index_type == mesh_index_u16 ?
+            ((const uint16_t*)indices)[i] : ((const uint32_t*)indices)[i];
+        if (index >= hdr->vertex_count) return NULL;
+    }
+
+    return hdr;
+}
+
+/*
+ * round to nearest even IEEE 754 half precision, flushing values below
+ * the smallest normal to zero and clamping overflow to infinity.
+ */
+static uint16_t mesh_float_to_half(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exp = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if (((x >> 23) & 0xff) == 0xff) {
+        return sign | 0x7c00 | (mant ? 0x200 : 0);
+    }
+    if (exp <= 0) return sign;
+    if (exp >= 31) return sign | 0x7c00;
+
+    uint32_t h = sign | (exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+    return (uint16_t)h;
+}
+
+static uint32_t mesh_pack_snorm10(float v)
+{
+    v = v < -1.0f ? -1.0f : v > 1.0f ? 1.0f : v;
+    return (uint32_t)(int32_t)lrintf(v * 511.0f) & 0x3ff;
+}
+
+static uint32_t mesh_pack_snorm10x3(float x, float y, float z)
+{
+    return mesh_pack_snorm10(x) | mesh_pack_snorm10(y) << 10 |
+        mesh_pack_snorm10(z) << 20;
+}
+
+static uint32_t mesh_pack_unorm8(float v)
+{
+    v = v < 0.0f ? 0.0f : v > 1.0f ? 1.0f : v;
+    return (uint32_t)lrintf(v * 255.0f);
+}
+
+static uint32_t mesh_pack_unorm8x4(float r, float g, float b, float a)
+{
+    return mesh_pack_unorm8(r) | mesh_pack_unorm8(g) << 8 |
+        mesh_pack_unorm8(b) << 16 | mesh_pack_unorm8(a) << 24;
+}
@@ -0,0 +1,453 @@
+/*
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * triangle mesh optimization
+ *
+ * passes operate in place on an indexed triangle list with 32-bit indices
+ * and vertices of any stride, and are intended to run in this order:
+ *
+ * - mesh_weld_vertices          merge byte identical vertices
+ * - mesh_optimize_vertex_cache  reorder triangles for the post-transform
+ *                               vertex cache using Forsyth's algorithm
+ * - mesh_optimize_overdraw      optionally reorder clusters of triangles
+ *                               front to back from the mesh centre
+ * - mesh_optimize_vertex_fetch  reorder vertices in order of first use
+ *                               and drop unreferenced vertices
+ *
+ * mesh_acmr measures the average cache miss ratio, the number of vertex
+ * shader invocations per triangle, with a FIFO cache of the given size.
+ * it ranges from 3.0 for no reuse down to about 0.5 for regular grids.
+ */
+
+enum { MESH_CACHE_SIZE = 32 };
+enum { MESH_FIFO_SIZE = 16 };
+
+static uint32_t mesh_weld_vertices(uint32_t *indices, size_t index_count,
+    void *vertices, uint32_t vertex_count, size_t stride);
+static void mesh_optimize_vertex_cache(uint32_t *indices, size_t index_count,
+    uint32_t vertex_count);
+static void mesh_optimize_overdraw(uint32_t *indices, size_t index_count,
+    const void *vertices, uint32_t vertex_count, size_t stride,
+    float threshold);
+static uint32_t mesh_optimize_vertex_fetch(uint32_t *indices,
+    size_t index_count, void *vertices, uint32_t vertex_count, size_t stride);
+static float mesh_acmr(const uint32_t *indices, size_t index_count,
+    uint32_t vertex_count, uint32_t cache_size);
+
+/*
+ * vertex welding
+ */
+
+static uint32_t mesh_hash_bytes(const void *data, size_t length)
+{
+    const unsigned char *p = (const unsigned char*)data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * merge vertices with identical bytes, compacting the vertex array and
+ * remapping indices. returns the new vertex count.
+ */
+static uint32_t mesh_weld_vertices(uint32_t *indices, size_t index_count,
+    void *vertices, uint32_t vertex_count, size_t stride)
+{
+    char *v = (char*)vertices;
+    size_t table_size = 1;
+    while (table_size < (size_t)vertex_count * 2) table_size <<= 1;
+
+    uint32_t *table = (uint32_t*)malloc(table_size * sizeof(uint32_t));
+    uint32_t *remap = (uint32_t*)malloc(vertex_count * sizeof(uint32_t));
+    uint32_t count = 0;
+    memset(table, 0xff, table_size * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < vertex_count; i++) {
+        size_t j = mesh_hash_bytes(v + i * stride, stride) & (table_size - 1);
+        while (table[j] != UINT32_MAX &&
+               memcmp(v + table[j] * stride, v + i * stride, stride) != 0) {
+            j = (j + 1) & (table_size - 1);
+        }
+        if (table[j] == UINT32_MAX) {
+            if (count != i) memmove(v + count * stride, v + i * stride, stride);
+            table[j] = count++;
+        }
+        remap[i] = table[j];
+    }
+
+    for (size_t i = 0; i < index_count; i++) {
+        indices[i] = remap[indices[i]];
+    }
+
+    free(remap);
+    free(table);
+    return count;
+}
+
+/*
+ * Forsyth linear-speed vertex cache optimisation
+ *
+ * vertices are scored by their position in a simulated LRU cache and by
+ * the number of triangles still using them, which favours finishing off
+ * vertices before they are evicted. each step emits the best scoring
+ * triangle adjacent to the cache, falling back to a linear scan.
+ */
+
+static float mesh_cache_scores[MESH_CACHE_SIZE];
+static float mesh_valence_scores[64];
+
+static void mesh_score_init()
+{
+    static int initialized = 0;
+    if (initialized) return;
+
+    for (int i = 0; i < MESH_CACHE_SIZE; i++) {
+        /* the last triangle's vertices get a fixed score so that the next
+         * triangle does not simply strip along the last edge */
+        mesh_cache_scores[i] = i < 3 ? 0.75f : powf(1.0f -
+            (float)(i - 3) / (MESH_CACHE_SIZE - 3), 1.5f);
+    }
+    for (int i = 0; i < 64; i++) {
+        mesh_valence_scores[i] = i == 0 ? 0.0f : 2.0f * powf((float)i, -0.5f);
+    }
+    initialized++;
+}
+
+static float mesh_vertex_score(int cache_pos, uint32_t valence)
+{
+    if (valence == 0) return -1.0f;
+    float s = cache_pos < 0 ? 0.0f : mesh_cache_scores[cache_pos];
+    return s + (valence < 64 ? mesh_valence_scores[valence] :
+        2.0f * powf((float)valence, -0.5f));
+}
+
+static void mesh_optimize_vertex_cache(uint32_t *indices, size_t index_count,
+    uint32_t vertex_count)
+{
+    size_t tri_count = index_count / 3;
+    if (tri_count == 0) return;
+
+    mesh_score_init();
+
+    uint32_t *valence = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+    uint32_t *adj_offset = (uint32_t*)malloc((vertex_count + 1) * sizeof(uint32_t));
+    uint32_t *adj = (uint32_t*)malloc(index_count * sizeof(uint32_t));
+    int *cache_pos = (int*)malloc(vertex_count * sizeof(int));
+    float *vscore = (float*)malloc(vertex_count * sizeof(float));
+    float *tscore = (float*)malloc(tri_count * sizeof(float));
+    char *emitted = (char*)calloc(tri_count, 1);
+    uint32_t *out = (uint32_t*)malloc(index_count * sizeof(uint32_t));
+    uint32_t cache[MESH_CACHE_SIZE + 3], new_cache[MESH_CACHE_SIZE + 3];
+    uint32_t cache_count = 0;
+
+    /* triangle adjacency for each vertex */
+    for (size_t i = 0; i < index_count; i++) valence[indices[i]]++;
+    adj_offset[0] = 0;
+    for (uint32_t v = 0; v < vertex_count; v++) {
+        adj_offset[v + 1] = adj_offset[v] + valence[v];
+        valence[v] = 0;
+    }
+    for (size_t t = 0; t < tri_count; t++) {
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = indices[t * 3 + k];
+            adj[adj_offset[v] + valence[v]++] = (uint32_t)t;
+        }
+    }
+
+    for (uint32_t v = 0; v < vertex_count; v++) {
+        cache_pos[v] = -1;
+        vscore[v] = mesh_vertex_score(-1, valence[v]);
+    }
+    size_t best = 0;
+    for (size_t t = 0; t < tri_count; t++) {
+        tscore[t] = vscore[indices[t * 3]] + vscore[indices[t * 3 + 1]] +
+            vscore[indices[t * 3 + 2]];
+        if (tscore[t] > tscore[best]) best = t;
+    }
+
+    size_t scan = 0;
+    for (size_t n = 0; n < tri_count; n++) {
+        const uint32_t *tri = &indices[best * 3];
+        memcpy(&out[n * 3], tri, 3 * sizeof(uint32_t));
+        emitted[best] = 1;
+
+        /* remove the triangle from the remaining adjacency of its vertices */
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = tri[k], *a = &adj[adj_offset[v]];
+            for (uint32_t j = 0; j < valence[v]; j++) {
+                if (a[j] == best) {
+                    a[j] = a[--valence[v]];
+                    break;
+                }
+            }
+        }
+
+        /* move the triangle's vertices to the front of the cache */
+        uint32_t new_count = 0;
+        for (int k = 0; k < 3; k++) new_cache[new_count++] = tri[k];
+        for (uint32_t j = 0; j < cache_count; j++) {
+            uint32_t v = cache[j];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                new_cache[new_count++] = v;
+            }
+        }
+        for (uint32_t j = 0; j < new_count; j++) {
+            uint32_t v = new_cache[j];
+            cache_pos[v] = j < MESH_CACHE_SIZE ? (int)j : -1;
+            vscore[v] = mesh_vertex_score(cache_pos[v], valence[v]);
+        }
+
+        /* rescore triangles adjacent to the cache and pick the best */
+        float best_score = -1.0f;
+        best = tri_count;
+        for (uint32_t j = 0; j < new_count; j++) {
+            uint32_t v = new_cache[j];
+            for (uint32_t a = 0; a < valence[v]; a++) {
+                uint32_t t = adj[adj_offset[v] + a];
+                const uint32_t *tv = &indices[t * 3];
+                tscore[t] = vscore[tv[0]] + vscore[tv[1]] + vscore[tv[2]];
+                if (tscore[t] > best_score) {
+                    best_score = tscore[t];
+                    best = t;
+                }
+            }
+        }
+
+        cache_count = new_count < MESH_CACHE_SIZE ? new_count : MESH_CACHE_SIZE;
+        memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+
+        if (best == tri_count) {
+            while (scan < tri_count && emitted[scan]) scan++;
+            best = scan;
+        }
+        if (best == tri_count) break;
+    }
+
+    memcpy(indices, out, tri_count * 3 * sizeof(uint32_t));
+
+    free(out);
+    free(emitted);
+    free(tscore);
+    free(vscore);
+    free(cache_pos);
+    free(adj);
+    free(adj_offset);
+    free(valence);
+}
+
+/*
+ * overdraw optimization
+ *
+ * the cache optimized triangle order is split into clusters, where the
+ * simulated cache is cold and where the running ACMR of a cluster falls
+ * to within threshold of the mesh ACMR, so that reordering clusters keeps
+ * most of the cache efficiency. clusters are sorted by how far they face
+ * outward from the mesh centre, which draws likely occluders first.
+ * threshold is the ratio to the mesh ACMR at which a cluster may be cut,
+ * higher values give smaller clusters, less overdraw and a higher ACMR.
+ */
+
+typedef struct {
+    uint32_t start;
+    uint32_t count;
+    float sort_key;
+} mesh_cluster;
+
+static int mesh_cluster_compare(const void *a, const void *b)
+{
+    float ka = ((const mesh_cluster*)a)->sort_key;
+    float kb = ((const mesh_cluster*)b)->sort_key;
+    return ka > kb ? -1 : ka < kb ? 1 : 0;
+}
+
+static const float* mesh_position(const void *vertices, size_t stride,
+    uint32_t i)
+{
+    return (const float*)((const char*)vertices + i * stride);
+}
+
+static void mesh_optimize_overdraw(uint32_t *indices, size_t index_count,
+    const void *vertices, uint32_t vertex_count, size_t stride,
+    float threshold)
+{
+    size_t tri_count = index_count / 3;
+    if (tri_count == 0) return;
+
+    float target = mesh_acmr(indices, index_count, vertex_count,
+        MESH_FIFO_SIZE) * threshold;
+    uint32_t *stamp = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+    mesh_cluster *clusters = (mesh_cluster*)malloc(tri_count * sizeof(mesh_cluster));
+    size_t cluster_count = 0;
+    uint32_t time = MESH_FIFO_SIZE + 1, misses = 0, start = 0;
+
+    /* split into clusters at cold cache and soft ACMR boundaries */
+    for (uint32_t t = 0; t < tri_count; t++) {
+        uint32_t tri_misses = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = indices[t * 3 + k];
+            if (time - stamp[v] > MESH_FIFO_SIZE) {
+                stamp[v] = time++;
+                tri_misses++;
+            }
+        }
+        if (t > start && tri_misses == 3) {
+            clusters[cluster_count++] = (mesh_cluster){ start, t - start, 0 };
+            start = t;
+            misses = 0;
+        }
+        misses += tri_misses;
+        if (t + 1 - start >= 8 && (float)misses / (t + 1 - start) <= target) {
+            clusters[cluster_count++] = (mesh_cluster){ start, t + 1 - start, 0 };
+            start = t + 1;
+            misses = 0;
+        }
+    }
+    if (start < tri_count) {
+        clusters[cluster_count++] = (mesh_cluster){ start,
+            (uint32_t)tri_count - start, 0 };
+    }
+
+    /* area weighted mesh centroid */
+    float mesh_centroid[3] = { 0, 0, 0 }, mesh_area = 0;
+    for (size_t t = 0; t < tri_count; t++) {
+        const float *p0 = mesh_position(vertices, stride, indices[t * 3]);
+        const float *p1 = mesh_position(vertices, stride, indices[t * 3 + 1]);
+        const float *p2 = mesh_position(vertices, stride, indices[t * 3 + 2]);
+        float e1[3], e2[3], n[3];
+        for (int i = 0; i < 3; i++) {
+            e1[i] = p1[i] - p0[i];
+            e2[i] = p2[i] - p0[i];
+        }
+        n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+        float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int i = 0; i < 3; i++) {
+            mesh_centroid[i] += (p0[i] + p1[i] + p2[i]) * area / 3.0f;
+        }
+        mesh_area += area;
+    }
+    if (mesh_area > 0) {
+        for (int i = 0; i < 3; i++) mesh_centroid[i] /= mesh_area;
+    }
+
+    /* sort key is the cluster normal dotted with its centroid offset */
+    for (size_t c = 0; c < cluster_count; c++) {
+        float centroid[3] = { 0, 0, 0 }, normal[3] = { 0, 0, 0 }, area = 0;
+        for (uint32_t t = clusters[c].start;
+             t < clusters[c].start + clusters[c].count; t++) {
+            const float *p0 = mesh_position(vertices, stride, indices[t * 3]);
+            const float *p1 = mesh_position(vertices, stride, indices[t * 3 + 1]);
+            const float *p2 = mesh_position(vertices, stride, indices[t * 3 + 2]);
+            float e1[3], e2[3], n[3];
+            for (int i = 0; i < 3; i++) {
+                e1[i] = p1[i] - p0[i];
+                e2[i] = p2[i] - p0[i];
+            }
+            n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+            n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+            n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+            float a = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            for (int i = 0; i < 3; i++) {
+                centroid[i] += (p0[i] + p1[i] + p2[i]) * a / 3.0f;
+                normal[i] += n[i];
+            }
+            area += a;
+        }
+        float key = 0, len = sqrtf(normal[0] * normal[0] +
+            normal[1] * normal[1] + normal[2] * normal[2]);
+        if (area > 0 && len > 0) {
+            for (int i = 0; i < 3; i++) {
+                key += (centroid[i] / area - mesh_centroid[i]) * normal[i] / len;
+            }
+        }
+        clusters[c].sort_key = key;
+    }
+
+    qsort(clusters, cluster_count, sizeof(mesh_cluster), mesh_cluster_compare);
+
+    uint32_t *out = (uint32_t*)malloc(tri_count * 3 * sizeof(uint32_t));
+    size_t n = 0;
+    for (size_t c = 0; c < cluster_count; c++) {
+        memcpy(&out[n], &indices[clusters[c].start * 3],
+            clusters[c].count * 3 * sizeof(uint32_t));
+        n += clusters[c].count * 3;
+    }
+    memcpy(indices, out, n * sizeof(uint32_t));
+
+    free(out);
+    free(clusters);
+    free(stamp);
+}
+
+/*
+ * reorder vertices in order of first use by the index list, dropping
+ * unreferenced vertices. returns the new vertex count.
+ */
+static uint32_t mesh_optimize_vertex_fetch(uint32_t *indices,
+    size_t index_count, void *vertices, uint32_t vertex_count, size_t stride)
+{
+    uint32_t *remap = (uint32_t*)malloc(vertex_count * sizeof(uint32_t));
+    char *out = (char*)malloc((size_t)vertex_count * stride);
+    uint32_t count = 0;
+    memset(remap, 0xff, vertex_count * sizeof(uint32_t));
+
+    for (size_t i = 0; i < index_count; i++) {
+        uint32_t v = indices[i];
+        if (remap[v] == UINT32_MAX) {
+            memcpy(out + count * stride, (char*)vertices + v * stride, stride);
+            remap[v] = count++;
+        }
+        indices[i] = remap[v];
+    }
+    memcpy(vertices, out, (size_t)count * stride);
+
+    free(out);
+    free(remap);
+    return count;
+}
+
+/*
+ * average cache miss ratio for a FIFO post-transform cache
+ */
+static float mesh_acmr(const uint32_t *indices, size_t index_count,
+    uint32_t vertex_count, uint32_t cache_size)
+{
+    size_t tri_count = index_count / 3, misses = 0;
+    if (tri_count == 0) return 0;
+
+    uint32_t *stamp = (uint32_t*)calloc(vertex_count, sizeof(uint32_t));
+    uint32_t time = cache_size + 1;
+    for (size_t i = 0; i < tri_count * 3; i++) {
+        uint32_t v = indices[i];
+        if (time - stamp[v] > cache_size) {
+            stamp[v] = time++;
+            misses++;
+        }
+    }
+    free(stamp);
+
+    return (float)misses / tri_count;
+}
@@ -0,0 +1,96 @@
+/*
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+
+/*
+ * lock-free single producer single consumer queue
+ *
+ * fixed size elements are copied into a power of two ring. the producer
+ * owns head and the consumer owns tail, each is only written by its owner
+ * and published with release ordering, and read by the peer with acquire
+ * ordering, so element contents are visible before the index that covers
+ * them. head and tail are on separate cache lines to avoid false sharing.
+ */
+
+enum { SPSC_CACHE_LINE_SIZE = 64 };
+
+typedef struct
+{
+    _Alignas(SPSC_CACHE_LINE_SIZE) atomic_size_t head;
+    _Alignas(SPSC_CACHE_LINE_SIZE) atomic_size_t tail;
+    _Alignas(SPSC_CACHE_LINE_SIZE) size_t capacity;
+    size_t elem_size;
+    char *data;
+} spsc_queue;
+
+static void spsc_queue_init(spsc_queue *q, size_t elem_size, size_t capacity);
+static void spsc_queue_destroy(spsc_queue *q);
+static size_t spsc_queue_count(spsc_queue *q);
+static int spsc_queue_push(spsc_queue *q, const void *elem);
+static int spsc_queue_pop(spsc_queue *q, void *elem);
+
+static void spsc_queue_init(spsc_queue *q, size_t elem_size, size_t capacity)
+{
+    assert((capacity & (capacity - 1)) == 0);
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    q->capacity = capacity;
+    q->elem_size = elem_size;
+    q->data = (char*)malloc(elem_size * capacity);
+}
+
+static void spsc_queue_destroy(spsc_queue *q)
+{
+    free(q->data);
+    q->data = NULL;
+}
+
+static size_t spsc_queue_count(spsc_queue *q)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    return head - tail;
+}
+
+/*
+ * called by the producer, returns 0 if the queue is full
+ */
+static int spsc_queue_push(spsc_queue *q, const void *elem)
+{
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+    if (head - tail == q->capacity) return 0;
+    memcpy(q->data + (head & (q->capacity - 1)) * q->elem_size,
+        elem, q->elem_size);
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return 1;
+}
+
+/*
+ * called by the consumer, returns 0 if the queue is empty
+ */
+static int spsc_queue_pop(spsc_queue *q, void *elem)
+{
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+    if (head == tail) return 0;
+    memcpy(elem, q->data + (tail & (q->capacity - 1)) * q->elem_size,
+        q->elem_size);
+    atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+    return 1;
+}
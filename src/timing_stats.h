@@ -0,0 +1,164 @@
+/*
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <string.h>
+
+/*
+ * timing series statistics
+ *
+ * keeps a sliding window of the most recent samples in arrival order and
+ * in sorted order. the sorted window is updated incrementally on each add
+ * by removing the evicted sample and inserting the new one, so percentiles,
+ * min and max are constant time lookups. mean and variance use running
+ * sums over the window and the exponentially weighted moving average
+ * covers all samples with weight 1/8th.
+ */
+
+enum { TIMING_SERIES_SIZE = 64 };
+
+typedef struct
+{
+    long count;
+    long offset;
+    long sum;
+    long long sum_sq;
+    long ewma;
+    long samples[TIMING_SERIES_SIZE];
+    long sorted[TIMING_SERIES_SIZE];
+} timing_series;
+
+static void timing_series_init(timing_series *ts);
+static void timing_series_add(timing_series *ts, long value);
+static long timing_series_count(timing_series *ts);
+static long timing_series_mean(timing_series *ts);
+static double timing_series_variance(timing_series *ts);
+static double timing_series_stddev(timing_series *ts);
+static long timing_series_ewma(timing_series *ts);
+static long timing_series_last(timing_series *ts);
+static long timing_series_min(timing_series *ts);
+static long timing_series_max(timing_series *ts);
+static long timing_series_percentile(timing_series *ts, int p);
+static long timing_series_median(timing_series *ts);
+
+static void timing_series_init(timing_series *ts)
+{
+    memset(ts, 0, sizeof(timing_series));
+}
+
+static long timing_series_count(timing_series *ts)
+{
+    return ts->count < TIMING_SERIES_SIZE ? ts->count : TIMING_SERIES_SIZE;
+}
+
+/*
+ * binary search for the first sorted sample not less than value
+ */
+static long timing_series_lower_bound(timing_series *ts, long n, long value)
+{
+    long lo = 0, hi = n;
+    while (lo < hi) {
+        long mid = (lo + hi) >> 1;
+        if (ts->sorted[mid] < value) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static void timing_series_add(timing_series *ts, long value)
+{
+    long n = timing_series_count(ts);
+
+    if (n == TIMING_SERIES_SIZE) {
+        long old_value = ts->samples[ts->offset];
+        long i = timing_series_lower_bound(ts, n, old_value);
+        memmove(&ts->sorted[i], &ts->sorted[i + 1], (n - i - 1) * sizeof(long));
+        ts->sum -= old_value;
+        ts->sum_sq -= (long long)old_value * old_value;
+        n--;
+    }
+
+    long i = timing_series_lower_bound(ts, n, value);
+    memmove(&ts->sorted[i + 1], &ts->sorted[i], (n - i) * sizeof(long));
+    ts->sorted[i] = value;
+
+    ts->samples[ts->offset] = value;
+    ts->sum += value;
+    ts->sum_sq += (long long)value * value;
+    ts->ewma = ts->count == 0 ? value : ts->ewma + (value - ts->ewma) / 8;
+    ts->count++;
+    ts->offset++;
+    if (ts->offset >= TIMING_SERIES_SIZE) {
+        ts->offset = 0;
+    }
+}
+
+static long timing_series_mean(timing_series *ts)
+{
+    long n = timing_series_count(ts);
+    return n == 0 ? -1 : ts->sum / n;
+}
+
+static double timing_series_variance(timing_series *ts)
+{
+    long n = timing_series_count(ts);
+    if (n < 2) return 0;
+    double mean = (double)ts->sum / n;
+    double var = ((double)ts->sum_sq - mean * ts->sum) / (n - 1);
+    return var < 0 ? 0 : var;
+}
+
+static double timing_series_stddev(timing_series *ts)
+{
+    return sqrt(timing_series_variance(ts));
+}
+
+static long timing_series_ewma(timing_series *ts)
+{
+    return ts->count == 0 ? -1 : ts->ewma;
+}
+
+static long timing_series_last(timing_series *ts)
+{
+    if (ts->count == 0) return -1;
+    return ts->samples[ts->offset > 0 ? ts->offset - 1 : TIMING_SERIES_SIZE - 1];
+}
+
+static long timing_series_min(timing_series *ts)
+{
+    return ts->count == 0 ? -1 : ts->sorted[0];
+}
+
+static long timing_series_max(timing_series *ts)
+{
+    return ts->count == 0 ? -1 : ts->sorted[timing_series_count(ts) - 1];
+}
+
+/*
+ * nearest rank percentile, p is in the range 0 to 100
+ */
+static long timing_series_percentile(timing_series *ts, int p)
+{
+    long n = timing_series_count(ts);
+    if (n == 0) return -1;
+    long rank = (p * n + 99) / 100;
+    return ts->sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static long timing_series_median(timing_series *ts)
+{
+    return timing_series_percentile(ts, 50);
+}
@@ -0,0 +1,237 @@
+/*
+ * PLEASE LICENSE 12/2021, Michael Clark <michaeljclark@mac.com>
+ *
+ * All rights to this work are granted for all purposes, with exception of
+ * author's implied right of copyright to defend the free use of this work.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <X11/Xlibint.h>
+#include <X11/extensions/presentproto.h>
+
+/*
+ * minimal X Present extension client
+ *
+ * only the requests needed for presentation feedback are implemented,
+ * directly on the Xlib wire protocol so there is no dependency on
+ * libXpresent. GLX swaps on DRI3 are performed with PresentPixmap by the
+ * driver, and any client that selects input on the window receives the
+ * resulting CompleteNotify and IdleNotify events. these arrive as generic
+ * events which are decoded into x11_present_event by a cookie converter,
+ * and are retrieved with XGetEventData.
+ */
+
+typedef struct
+{
+    int opcode;
+    int event_base;
+    int error_base;
+    int major;
+    int minor;
+} x11_present;
+
+typedef struct
+{
+    int evtype;
+    Window window;
+    uint32_t serial;
+    int kind;
+    int mode;
+    uint64_t ust;
+    uint64_t msc;
+    Pixmap pixmap;
+} x11_present_event;
+
+static const char* x11_present_mode_names[] = {
+    [PresentCompleteModeCopy] = "copy",
+    [PresentCompleteModeFlip] = "flip",
+    [PresentCompleteModeSkip] = "skip",
+    [PresentCompleteModeSuboptimalCopy] = "suboptimal-copy",
+};
+
+static int x11_present_init(Display *dpy, x11_present *p);
+static XID x11_present_select_input(Display *dpy, x11_present *p,
+    Window w, unsigned mask);
+static void x11_present_notify_msc(Display *dpy, x11_present *p, Window w,
+    uint32_t serial, uint64_t target_msc, uint64_t divisor,
+    uint64_t remainder);
+static int x11_present_event_data(Display *dpy, x11_present *p,
+    XGenericEventCookie *cookie, x11_present_event *ev);
+
+static Bool x11_present_wire_to_cookie(Display *dpy,
+    XGenericEventCookie *cookie, xEvent *wire)
+{
+    xGenericEvent *ge = (xGenericEvent*)wire;
+    x11_present_event *ev;
+
+    cookie->type = ge->type & 0x7f;
+    cookie->serial = _XSetLastRequestRead(dpy, (xGenericReply*)wire);
+    cookie->send_event = (ge->type & 0x80) != 0;
+    cookie->display = dpy;
+    cookie->extension = ge->extension;
+    cookie->evtype = ge->evtype;
+    cookie->data = NULL;
+
+    switch (ge->evtype) {
+    case PresentCompleteNotify: {
+        xPresentCompleteNotify *proto = (xPresentCompleteNotify*)wire;
+        if (!(ev = (x11_present_event*)calloc(1, sizeof(*ev)))) return False;
+        ev->evtype = proto->evtype;
+        ev->window = proto->window;
+        ev->serial = proto->serial;
+        ev->kind = proto->kind;
+        ev->mode = proto->mode;
+        ev->ust = proto->ust;
+        ev->msc = proto->msc;
+        break;
+    }
+    case PresentIdleNotify: {
+        xPresentIdleNotify *proto = (xPresentIdleNotify*)wire;
+        if (!(ev = (x11_present_event*)calloc(1, sizeof(*ev)))) return False;
+        ev->evtype = proto->evtype;
+        ev->window = proto->window;
+        ev->serial = proto->serial;
+        ev->pixmap = proto->pixmap;
+        break;
+    }
+    default:
+        return False;
+    }
+
+    cookie->data = ev;
+    return True;
+}
+
+static Bool x11_present_copy_cookie(Display *dpy,
+    XGenericEventCookie *in, XGenericEventCookie *out)
+{
+    *out = *in;
+    if (!in->data) return True;
+    if (!(out->data = malloc(sizeof(x11_present_event)))) return False;
+    memcpy(out->data, in->data, sizeof(x11_present_event));
+    return True;
+}
+
+static int x11_present_query_version(Display *dpy, x11_present *p)
+{
+    xPresentQueryVersionReq *req;
+    xPresentQueryVersionReply rep;
+
+    LockDisplay(dpy);
+    GetReq(PresentQueryVersion, req);
+    req->reqType = p->opcode;
+    req->presentReqType = X_PresentQueryVersion;
+    req->majorVersion = 1;
+    req->minorVersion = 2;
+    if (!_XReply(dpy, (xReply*)&rep, 0, xFalse)) {
+        UnlockDisplay(dpy);
+        SyncHandle();
+        return -1;
+    }
+    p->major = rep.majorVersion;
+    p->minor = rep.minorVersion;
+    UnlockDisplay(dpy);
+    SyncHandle();
+    return 0;
+}
+
+/*
+ * probe for the extension and register the event decoder, returns -1
+ * if the server does not support Present
+ */
+static int x11_present_init(Display *dpy, x11_present *p)
+{
+    memset(p, 0, sizeof(x11_present));
+
+    if (!XQueryExtension(dpy, PRESENT_NAME, &p->opcode, &p->event_base,
+                         &p->error_base)) {
+        return -1;
+    }
+    if (x11_present_query_version(dpy, p) < 0) {
+        return -1;
+    }
+
+    XESetWireToEventCookie(dpy, p->opcode, x11_present_wire_to_cookie);
+    XESetCopyEventCookie(dpy, p->opcode, x11_present_copy_cookie);
+    return 0;
+}
+
+/*
+ * select Present events on a window, returns the new event id. each
+ * window needs its own event id.
+ */
+static XID x11_present_select_input(Display *dpy, x11_present *p,
+    Window w, unsigned mask)
+{
+    xPresentSelectInputReq *req;
+    XID eid = XAllocID(dpy);
+
+    LockDisplay(dpy);
+    GetReq(PresentSelectInput, req);
+    req->reqType = p->opcode;
+    req->presentReqType = X_PresentSelectInput;
+    req->eid = eid;
+    req->window = w;
+    req->eventMask = mask;
+    UnlockDisplay(dpy);
+    SyncHandle();
+    return eid;
+}
+
+/*
+ * request a CompleteNotify of kind NotifyMSC when the window's CRTC
+ * reaches the given MSC, or the next MSC that satisfies divisor and
+ * remainder. a zero target and divisor notify on the next vblank.
+ */
+static void x11_present_notify_msc(Display *dpy, x11_present *p, Window w,
+    uint32_t serial, uint64_t target_msc, uint64_t divisor,
+    uint64_t remainder)
+{
+    xPresentNotifyMSCReq *req;
+
+    LockDisplay(dpy);
+    GetReq(PresentNotifyMSC, req);
+    req->reqType = p->opcode;
+    req->presentReqType = X_PresentNotifyMSC;
+    req->window = w;
+    req->serial = serial;
+    req->target_msc = target_msc;
+    req->divisor = divisor;
+    req->remainder = remainder;
+    UnlockDisplay(dpy);
+    SyncHandle();
+}
+
+/*
+ * decode a generic event cookie, returns 1 if it was a Present event
+ */
+static int x11_present_event_data(Display *dpy, x11_present *p,
+    XGenericEventCookie *cookie, x11_present_event *ev)
+{
+    int ret = 0;
+
+    if (cookie->type != GenericEvent || cookie->extension != p->opcode) {
+        return 0;
+    }
+    if (XGetEventData(dpy, cookie)) {
+        if (cookie->data) {
+            *ev = *(x11_present_event*)cookie->data;
+            ret = 1;
+        }
+        XFreeEventData(dpy, cookie);
+    }
+    return ret;
+}